@@ -0,0 +1,281 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#include "Allocations.h"
+
+#include <new>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+
+static constexpr const char* allocationsEnvVarName = "CLI_BASE_ALLOCATIONS";
+
+/// The innermost phase and applet of the thread.
+static thread_local const char* currentPhase;
+static thread_local const char* currentApplet;
+
+/**
+ * The counters of the phase and applet pairs.
+ *
+ * The table is zero initialized and has a fixed size, so counting an
+ * allocation does not allocate. If it is full the allocations of new
+ * pairs are only counted in the totals.
+ */
+namespace
+{
+	struct Entry
+	{
+		bool used;
+		const char* phase;
+		const char* applet;
+		Allocations::Counters counters;
+	};
+
+	constexpr size_t tableSize = 512;
+
+	std::mutex mutex;
+	Entry table[tableSize];
+	Allocations::Counters total;
+
+	inline bool matches(const char* name, std::string_view filter) {
+		return filter.empty() || (name && filter == name);
+	}
+}
+
+/// Count an allocation of the thread.
+static inline void count(size_t size)
+{
+	const auto phase = currentPhase;
+	const auto applet = currentApplet;
+
+	const auto key = reinterpret_cast<uintptr_t>(phase) ^ (reinterpret_cast<uintptr_t>(applet) >> 3);
+	auto idx = static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> 32) % tableSize;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	total.count++;
+	total.bytes += size;
+
+	for(auto i = 0u; i < tableSize; i++, idx = (idx + 1) % tableSize)
+	{
+		auto &e = table[idx];
+
+		if(!e.used)
+		{
+			e.used = true;
+			e.phase = phase;
+			e.applet = applet;
+		}
+		else if(e.phase != phase || e.applet != applet)
+		{
+			continue;
+		}
+
+		e.counters.count++;
+		e.counters.bytes += size;
+		return;
+	}
+}
+
+const char* Allocations::swapPhase(const char* phase)
+{
+	const auto ret = currentPhase;
+	currentPhase = phase;
+	return ret;
+}
+
+const char* Allocations::swapApplet(const char* applet)
+{
+	const auto ret = currentApplet;
+	currentApplet = applet;
+	return ret;
+}
+
+Allocations::Counters Allocations::query(std::string_view phase, std::string_view applet)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(phase.empty() && applet.empty())
+	{
+		return total;
+	}
+
+	Counters ret;
+
+	for(const auto &e: table)
+	{
+		if(e.used && matches(e.phase, phase) && matches(e.applet, applet))
+		{
+			ret.count += e.counters.count;
+			ret.bytes += e.counters.bytes;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Writes the counters to the file named by the environment
+ * variable when destroyed at the exit of the process.
+ */
+static struct Report
+{
+	static void writeName(FILE* f, const char* name)
+	{
+		if(name)
+		{
+			fprintf(f, "\"%s\"", name);
+		}
+		else
+		{
+			fprintf(f, "null");
+		}
+	}
+
+	~Report()
+	{
+		const auto path = std::getenv(allocationsEnvVarName);
+
+		if(!Allocations::enabled || !path || !*path)
+		{
+			return;
+		}
+
+		// Copied first, because writing the file allocates too.
+		static Entry entries[tableSize];
+		Allocations::Counters sum;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::copy(table, table + tableSize, entries);
+			sum = total;
+		}
+
+		if(FILE* f = fopen(path, "w"))
+		{
+			fprintf(f, "{\"total\":{\"allocations\":%llu,\"bytes\":%llu},\"phases\":[", sum.count, sum.bytes);
+
+			bool first = true;
+
+			for(const auto &e: entries)
+			{
+				if(e.used)
+				{
+					fprintf(f, "%s\n{\"phase\":", first ? "" : ",");
+					writeName(f, e.phase);
+					fprintf(f, ",\"applet\":");
+					writeName(f, e.applet);
+					fprintf(f, ",\"allocations\":%llu,\"bytes\":%llu}", e.counters.count, e.counters.bytes);
+					first = false;
+				}
+			}
+
+			fprintf(f, "\n]}\n");
+			fclose(f);
+		}
+	}
+} report;
+
+#ifdef CLI_BASE_COUNT_ALLOCATIONS
+
+const bool Allocations::enabled = true;
+
+/*
+ * Only the basic forms are replaced, the array and nothrow forms of the
+ * standard library forward to these. The memory comes from malloc, so
+ * the deallocation functions are replaced too, to be sure they match.
+ */
+
+void* operator new(std::size_t size)
+{
+	while(true)
+	{
+		if(const auto ret = std::malloc(size ? size : 1))
+		{
+			count(size);
+			return ret;
+		}
+
+		if(const auto handler = std::get_new_handler())
+		{
+			handler();
+		}
+		else
+		{
+#if __cpp_exceptions
+			throw std::bad_alloc();
+#else
+			std::abort();
+#endif
+		}
+	}
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	const auto align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+
+	while(true)
+	{
+		void* ret;
+
+		if(posix_memalign(&ret, align, size ? size : 1) == 0)
+		{
+			count(size);
+			return ret;
+		}
+
+		if(const auto handler = std::get_new_handler())
+		{
+			handler();
+		}
+		else
+		{
+#if __cpp_exceptions
+			throw std::bad_alloc();
+#else
+			std::abort();
+#endif
+		}
+	}
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+	std::free(ptr);
+}
+
+#else
+
+const bool Allocations::enabled = false;
+
+#endif
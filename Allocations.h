@@ -0,0 +1,109 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#ifndef CLI_BASE_ALLOCATIONS_H_
+#define CLI_BASE_ALLOCATIONS_H_
+
+#include <string_view>
+
+/**
+ * Heap allocation accounting of the framework phases.
+ *
+ * If Allocations.cpp is compiled with CLI_BASE_COUNT_ALLOCATIONS defined,
+ * it replaces the global allocation functions with ones that count the
+ * allocations and the bytes allocated, attributed to the innermost phase
+ * (the name of the innermost Trace::Span) and the applet being run on the
+ * allocating thread. If the CLI_BASE_ALLOCATIONS environment variable is
+ * set to a file name, the counters are written to that file as JSON at exit.
+ *
+ * The counters can also be queried at run time, so that tests and
+ * benchmarks can check them against a budget. Without the define nothing
+ * is counted, and a scope only costs testing a flag.
+ */
+class Allocations
+{
+	/// Set the innermost phase or applet of the thread, returns the previous one.
+	static const char* swapPhase(const char* phase);
+	static const char* swapApplet(const char* applet);
+
+public:
+	/// Whether the allocation functions are replaced, so that the allocations are counted.
+	static const bool enabled;
+
+	/// The number of allocations and the bytes allocated.
+	struct Counters
+	{
+		unsigned long long count = 0, bytes = 0;
+	};
+
+	/**
+	 * Scoped attribution of the allocations of the thread to a phase,
+	 * this is part of every Trace::Span. The name must be a string literal.
+	 */
+	class Phase
+	{
+		const char* const outer;
+
+	public:
+		inline Phase(const char* name): outer(enabled ? swapPhase(name) : nullptr) {}
+
+		inline ~Phase()
+		{
+			if(enabled)
+			{
+				swapPhase(outer);
+			}
+		}
+
+		Phase(const Phase&) = delete;
+		Phase& operator=(const Phase&) = delete;
+	};
+
+	/**
+	 * Scoped attribution of the allocations of the thread to an applet,
+	 * the name must be static (like the one in the registry entry).
+	 */
+	class Applet
+	{
+		const char* const outer;
+
+	public:
+		inline Applet(const char* name): outer(enabled ? swapApplet(name) : nullptr) {}
+
+		inline ~Applet()
+		{
+			if(enabled)
+			{
+				swapApplet(outer);
+			}
+		}
+
+		Applet(const Applet&) = delete;
+		Applet& operator=(const Applet&) = delete;
+	};
+
+	/**
+	 * The allocations counted since the start of the process, limited to
+	 * a phase and/or an applet if specified (empty matches any). The
+	 * allocations outside of any phase or applet are only in the totals.
+	 */
+	static Counters query(std::string_view phase = {}, std::string_view applet = {});
+};
+
+#endif /* CLI_BASE_ALLOCATIONS_H_ */
@@ -21,26 +21,166 @@
 #define CLI_BASE_ARGUMENTREADER_H_
 
 #include <list>
+#include <vector>
 #include <string>
-#include <stdexcept>
+#include <charconv>
+#include <string_view>
+#include <variant>
+#include <utility>
+#include <system_error>
 #include <filesystem>
+#include <type_traits>
 
 /// Argument value parser for option callbacks.
 template<class T> struct ArgumentParser;
 
+/// Diagnostic of an argument that could not be read.
+struct ParseError
+{
+	std::string message;
+};
+
+/**
+ * The result of reading an argument, either the value or the diagnostic.
+ *
+ * The argument parsers report missing or malformed values with this instead
+ * of exceptions, so that parsing also works with -fno-exceptions. An error
+ * can be returned directly as a ParseError, or taken over from another
+ * result (by returning its error).
+ */
+template<class T>
+class Parsed
+{
+	std::variant<T, ParseError> content;
+
+public:
+	inline Parsed(T value): content(std::in_place_index<0>, std::move(value)) {}
+	inline Parsed(ParseError error): content(std::in_place_index<1>, std::move(error)) {}
+
+	/// Whether the value could be read.
+	inline explicit operator bool() const {
+		return content.index() == 0;
+	}
+
+	/// The value, only if it could be read.
+	inline T& operator*() {
+		return *std::get_if<0>(&content);
+	}
+
+	inline const T& operator*() const {
+		return *std::get_if<0>(&content);
+	}
+
+	/// The diagnostic, only if the value could not be read.
+	inline const ParseError& error() const {
+		return *std::get_if<1>(&content);
+	}
+};
+
+/**
+ * Read an argument with its parser.
+ *
+ * Parsers may also return the value directly (and throw on error, which
+ * needs exceptions), the result is wrapped in that case.
+ */
+template<class T, class It>
+inline Parsed<T> readArgument(It& it, const It& end)
+{
+	if constexpr(std::is_same_v<decltype(ArgumentParser<T>::parse(it, end)), Parsed<T>>)
+	{
+		return ArgumentParser<T>::parse(it, end);
+	}
+	else
+	{
+		return Parsed<T>(ArgumentParser<T>::parse(it, end));
+	}
+}
+
+/**
+ * The type name of an argument type followed by a suffix, assembled at
+ * compile time, so that it is a static string like the other type names.
+ */
+template<class T, char... Suffix>
+struct SuffixedTypeName
+{
+	static constexpr size_t length(const char* str)
+	{
+		size_t ret = 0;
+
+		while(str[ret])
+		{
+			ret++;
+		}
+
+		return ret;
+	}
+
+	static constexpr size_t baseLength = length(ArgumentParser<T>::typeName);
+
+	struct Storage
+	{
+		char str[baseLength + sizeof...(Suffix) + 1];
+	};
+
+	static constexpr Storage assemble()
+	{
+		Storage ret{};
+		size_t i = 0;
+
+		for(; i < baseLength; i++)
+		{
+			ret.str[i] = ArgumentParser<T>::typeName[i];
+		}
+
+		((ret.str[i++] = Suffix), ...);
+		return ret;
+	}
+
+	static constexpr Storage storage = assemble();
+
+	static constexpr const char* value = storage.str;
+};
+
+/**
+ * Whether the suggestion candidates for an argument type depend on the
+ * state of the system at the time of completion (e.g. a list of running
+ * processes), as opposed to being fixed for the program.
+ *
+ * Argument parsers can declare this with a static constexpr bool member
+ * called dynamicCandidates, fixed candidates are assumed otherwise.
+ */
+template<class T, class = void> struct HasDynamicCandidates: std::false_type {};
+
+template<class T>
+struct HasDynamicCandidates<T, std::void_t<decltype(ArgumentParser<T>::dynamicCandidates)>>:
+	std::bool_constant<ArgumentParser<T>::dynamicCandidates> {};
+
+/**
+ * Whether an argument type generates its completion candidates in process.
+ *
+ * Argument parsers can declare this with a static complete method, that takes
+ * the word being completed and returns the candidates the same way as suggest
+ * (which is still used to find the kind of candidates, e.g. for the manifest).
+ * The code 3 means that the candidates are already filtered by the word.
+ */
+template<class T, class = void> struct HasInProcessCompletion: std::false_type {};
+
+template<class T>
+struct HasInProcessCompletion<T, std::void_t<decltype(ArgumentParser<T>::complete(std::string_view{}))>>: std::true_type {};
+
 template<> struct ArgumentParser<std::string>
 {
 	static constexpr const auto typeName = "text";
 
 	template<class It>
-	static inline std::string parse(It& it, const It &end)
+	static inline Parsed<std::string> parse(It& it, const It &end)
 	{
 		if(it != end)
 		{
-			return *it++;
+			return std::string(*it++);
 		}
 
-		throw std::runtime_error("missing string argument");
+		return ParseError{"missing string argument"};
 	}
 
 	static inline std::pair<int, std::list<std::string>> suggest() {
@@ -48,19 +188,20 @@ template<> struct ArgumentParser<std::string>
 	}
 };
 
-template<> struct ArgumentParser<int>
+/// Zero-copy variant of the text argument, refers to the storage of the command line.
+template<> struct ArgumentParser<std::string_view>
 {
-	static constexpr const auto typeName = "int";
+	static constexpr const auto typeName = "text";
 
 	template<class It>
-	static inline int parse(It& it, const It& end)
+	static inline Parsed<std::string_view> parse(It& it, const It &end)
 	{
 		if(it != end)
 		{
-			return std::stoi(*it++);
+			return *it++;
 		}
 
-		throw std::runtime_error("missing integer argument");
+		return ParseError{"missing string argument"};
 	}
 
 	static inline std::pair<int, std::list<std::string>> suggest() {
@@ -68,44 +209,146 @@ template<> struct ArgumentParser<int>
 	}
 };
 
-template<> struct ArgumentParser<unsigned int>
+/**
+ * Parse a number from the whole of a string.
+ *
+ * Uses std::from_chars, so it is locale independent and does not allocate
+ * (except for the error message). A leading plus sign is accepted.
+ */
+template<class T>
+inline Parsed<T> parseNumber(std::string_view str, const char* typeName)
 {
-	static constexpr const auto typeName = "uint";
+	const auto digits = (str.size() > 1 && str[0] == '+' && str[1] != '-') ? str.substr(1) : str;
+	const auto end = digits.data() + digits.size();
 
+	T ret;
+	const auto result = std::from_chars(digits.data(), end, ret);
+
+	if(result.ec == std::errc::result_out_of_range)
+	{
+		return ParseError{std::string(typeName) + " value out of range: '" + std::string(str) + "'"};
+	}
+
+	if(result.ec != std::errc() || result.ptr != end)
+	{
+		return ParseError{std::string("invalid ") + typeName + " value: '" + std::string(str) + "'"};
+	}
+
+	return ret;
+}
+
+/// Common implementation of the parsers of numeric types.
+template<class T>
+struct NumberArgumentParser
+{
 	template<class It>
-	static inline unsigned int parse(It& it, const It& end)
+	static inline Parsed<T> parse(It& it, const It& end)
 	{
 		if(it != end)
 		{
-			return std::stoul(*it++);
+			return parseNumber<T>(*it++, ArgumentParser<T>::typeName);
 		}
 
-		throw std::runtime_error("missing unsigned integer argument");
+		return ParseError{std::string("missing ") + ArgumentParser<T>::typeName + " argument"};
 	}
 
 	static inline std::pair<int, std::list<std::string>> suggest() {
-		return {0, {typeName}};
+		return {0, {ArgumentParser<T>::typeName}};
 	}
 };
 
-template<> struct ArgumentParser<float>
-{
+template<> struct ArgumentParser<short>: NumberArgumentParser<short> {
+	static constexpr const auto typeName = "short";
+};
+
+template<> struct ArgumentParser<unsigned short>: NumberArgumentParser<unsigned short> {
+	static constexpr const auto typeName = "ushort";
+};
+
+template<> struct ArgumentParser<int>: NumberArgumentParser<int> {
+	static constexpr const auto typeName = "int";
+};
+
+template<> struct ArgumentParser<unsigned int>: NumberArgumentParser<unsigned int> {
+	static constexpr const auto typeName = "uint";
+};
+
+template<> struct ArgumentParser<long>: NumberArgumentParser<long> {
+	static constexpr const auto typeName = "long";
+};
+
+template<> struct ArgumentParser<unsigned long>: NumberArgumentParser<unsigned long> {
+	static constexpr const auto typeName = "ulong";
+};
+
+template<> struct ArgumentParser<long long>: NumberArgumentParser<long long> {
+	static constexpr const auto typeName = "llong";
+};
+
+template<> struct ArgumentParser<unsigned long long>: NumberArgumentParser<unsigned long long> {
+	static constexpr const auto typeName = "ullong";
+};
+
+template<> struct ArgumentParser<float>: NumberArgumentParser<float> {
 	static constexpr const auto typeName = "float";
+};
+
+template<> struct ArgumentParser<double>: NumberArgumentParser<double> {
+	static constexpr const auto typeName = "double";
+};
+
+/**
+ * Values of a variadic option.
+ *
+ * As the last argument of an option callback, it takes all the following
+ * command line arguments up to the next recognized option key or a "--"
+ * (which is consumed), parsed as the element type.
+ */
+template<class T> struct Variadic: std::vector<T> {
+	using std::vector<T>::vector;
+};
 
+template<class T> struct ArgumentParser<Variadic<T>>
+{
+	static constexpr const auto typeName = SuffixedTypeName<T, '.', '.', '.'>::value;
+
+	/// The command line arguments are limited to the values when this is invoked.
 	template<class It>
-	static inline int parse(It& it, const It& end)
+	static inline Parsed<Variadic<T>> parse(It& it, const It& end)
 	{
-		if(it != end)
+		Variadic<T> ret;
+		ret.reserve(end - it);
+
+		while(it != end)
 		{
-			return std::stof(*it++);
+			auto value = readArgument<T>(it, end);
+
+			if(!value)
+			{
+				return value.error();
+			}
+
+			ret.push_back(std::move(*value));
 		}
 
-		throw std::runtime_error("missing integer argument");
+		return ret;
 	}
 
-	static inline std::pair<int, std::list<std::string>> suggest() {
-		return {0, {typeName}};
+	static inline auto suggest() {
+		return ArgumentParser<T>::suggest();
+	}
+
+	template<class U = T, class = std::enable_if_t<HasInProcessCompletion<U>::value>>
+	static inline auto complete(std::string_view word) {
+		return ArgumentParser<T>::complete(word);
 	}
 };
 
+/// Whether an argument type is variadic.
+template<class T> struct IsVariadic: std::false_type {};
+template<class T> struct IsVariadic<Variadic<T>>: std::true_type {};
+
+template<class T>
+struct HasDynamicCandidates<Variadic<T>>: HasDynamicCandidates<T> {};
+
 #endif /* CLI_BASE_ARGUMENTREADER_H_ */
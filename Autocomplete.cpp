@@ -17,89 +17,149 @@
  *
  *******************************************************************************/
 
-#include "CliApp.h"
+#include "Autocomplete.h"
+#include "CandidateRanker.h"
+#include "Trace.h"
 
-#include <iostream>
-#include <sstream>
+#include <algorithm>
 
-struct Autocompleter: CliApp
-{
-	static Autocompleter instance;
-	inline void dummy() {}
-	virtual ~Autocompleter() = default;
-	Autocompleter(): CliApp("_autocomplete") {instance.dummy(); }
-
-	virtual const char* getDesc() const override { return "Autocomplete helper"; };
+#include <cerrno>
 
-	virtual bool visibleByDefault() const override { return false; }
+#include <unistd.h>
+#include <sys/uio.h>
 
-	virtual std::pair<int, std::list<std::string>> autocomplete(std::list<std::string>::const_iterator from, std::list<std::string>::const_iterator to) override {
-		return {-1, {"To understand recursion, you must first understand recursion"}};
-	}
+int Autocompleter::complete(const OptionParser::Arguments& request, std::string& out, char delimiter)
+{
+	Trace::Span span("autocomplete");
 
-	virtual int operator()(int argc, const char* argv[])
+	const auto run = [&]() -> int
 	{
-		try
+		if(request.size() >= 2)
 		{
-			std::list<std::string> nonOpt = {argv, argv + argc};
+			auto it = request.begin();
 
-			if(nonOpt.size() >= 2)
+			const auto wordIdx = parseNumber<unsigned long>(*it++, "index");
+
+			if(!wordIdx)
 			{
-				auto it = nonOpt.begin();
+				return -1;
+			}
 
-				const auto wordIdx = std::stoul(*it++);
-				assert(wordIdx > 0);
+			assert(*wordIdx > 0);
 
-				const auto binaryName = *it++;
+			it++; // binary name
 
-				std::list<std::string> args;
-				for(auto i = 1u; i < wordIdx; i++)
-				{
-					if(it == nonOpt.end())
-					{
-						break;
-					}
+			const auto wordIt = it + std::min<size_t>(*wordIdx - 1, request.end() - it);
+			const OptionParser::Arguments args(it, wordIt);
 
-					args.push_back(std::move(*it++));
-				}
+			// The candidates are filtered and ranked here, the script gets the final list.
+			const auto word = (wordIt != request.end()) ? *wordIt : std::string_view{};
+			CandidateRanker ranker(word);
+			const OptionParser::Sink offer = [&ranker](std::string_view c) { ranker.offer(c); };
+			int ret = 0;
+
+			auto argIt = args.cbegin();
+			const auto& command = ::CliApp::resolve(argIt, args.cend());
 
-				if(args.empty())
+			// All the words name commands, so the word under the cursor may be a subcommand.
+			if(argIt == args.cend())
+			{
+				for(auto c = command.firstChild; c != command.lastChild; c++)
 				{
-					for(const auto& a: ::CliApp::apps)
+					if(c->visible())
 					{
-						if(a.second->visibleByDefault())
-						{
-							std::cout << a.first << std::endl;
-						}
+						offer(c->word);
 					}
 				}
-				else
-				{
-					auto argIt = args.cbegin();
-					if(auto appIt = ::CliApp::apps.find(*argIt++); appIt != ::CliApp::apps.end())
-					{
-						auto ret = appIt->second->autocomplete(argIt, args.cend());
+			}
 
-						for(const auto& a: ret.second)
-						{
-							std::cout << a << std::endl;
-						}
+			if(const auto app = command.entry)
+			{
+				const Allocations::Applet applet(app->name);
+				ret = app->instance().autocomplete(argIt, args.cend(), word, offer);
+			}
+			else if(argIt != args.cend())
+			{
+				return -1;
+			}
 
-						return ret.first;
-					}
-					else
-					{
-						return -1;
-					}
-				}
+			if(ret == 0 || ret == 3)
+			{
+				ranker.emit([&out, delimiter](std::string_view c) { out.append(c).push_back(delimiter); });
 
-				return 0;
+				// Only the scripts requesting the NUL delimited format know code 3, the older ones filter again.
+				return (delimiter == '\0') ? 3 : 0;
 			}
+
+			return ret;
 		}
-		catch(...) {}
 
 		return -1;
+	};
+
+	// The applet body is run for collecting the options, so anything thrown there must not escape.
+#if __cpp_exceptions
+	try
+	{
+		return run();
 	}
-};
+	catch(...)
+	{
+		return -1;
+	}
+#else
+	return run();
+#endif
+}
+
+int Autocompleter::operator()(int argc, const char* argv[])
+{
+	const bool nulDelimited = argc > 0 && argv[0] == nulDelimitedFlag;
+	const auto delimiter = nulDelimited ? '\0' : '\n';
+
+	std::string out;
+	const auto ret = complete(OptionParser::Arguments(argv + nulDelimited, argv + argc), out, delimiter);
+
+	// The return code is also passed in band in the NUL delimited format, as it is read with mapfile.
+	std::string code;
+
+	if(nulDelimited)
+	{
+		code.append(std::to_string(ret)).push_back(delimiter);
+	}
+
+	// All of the output is written at once, instead of flushing every line.
+	struct iovec iov[] = {{code.data(), code.size()}, {out.data(), out.size()}};
+
+	for(size_t i = 0; i < 2;)
+	{
+		const auto n = writev(STDOUT_FILENO, iov + i, 2 - i);
+
+		if(n < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			break;
+		}
+
+		size_t done = n;
+
+		for(; i < 2 && done >= iov[i].iov_len; i++)
+		{
+			done -= iov[i].iov_len;
+		}
+
+		if(i < 2)
+		{
+			iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + done;
+			iov[i].iov_len -= done;
+		}
+	}
+
+	return ret;
+}
 
-Autocompleter Autocompleter::instance;
+CLI_APP_REGISTER(Autocompleter, false);
@@ -0,0 +1,80 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+
+#ifndef CLI_BASE_AUTOCOMPLETE_H_
+#define CLI_BASE_AUTOCOMPLETE_H_
+
+#include "CliApp.h"
+
+#include <string>
+#include <string_view>
+
+/**
+ * Hidden applet that generates the candidates for the shell completion script.
+ */
+struct Autocompleter: CliApp
+{
+	static constexpr const char* appName = "_autocomplete";
+	static constexpr const char* appDesc = "Autocomplete helper";
+
+	static inline CliApp& instance()
+	{
+		static Autocompleter instance;
+		return instance;
+	}
+
+	virtual ~Autocompleter() = default;
+
+	/**
+	 * Argument preceding the request that selects the NUL delimited output
+	 * format, in which the first field is the return code, followed by the
+	 * candidates (which may contain newlines then), each terminated by NUL.
+	 */
+	static constexpr std::string_view nulDelimitedFlag = "-0";
+
+	/**
+	 * Generate completion candidates for a request.
+	 *
+	 * The request consists of the index of the word under the cursor, the
+	 * name of the binary and the words of the command line. The candidates
+	 * are appended to the buffer, each terminated by the delimiter, the
+	 * return value is the code interpreted by the completion script.
+	 *
+	 * Word candidates are matched against the word under the cursor and
+	 * only the best ones are kept (see CandidateRanker). In the NUL
+	 * delimited format the code for them is 3 (filtered), so the script
+	 * uses them as they are. In the newline delimited format it is still
+	 * 0, for the scripts installed before code 3 was introduced.
+	 */
+	static int complete(const OptionParser::Arguments& request, std::string& out, char delimiter = '\n');
+
+	virtual int autocomplete(OptionParser::ArgIter from, OptionParser::ArgIter to, std::string_view word, const OptionParser::Sink& sink) override {
+		sink("To understand recursion, you must first understand recursion");
+		return -1;
+	}
+
+	virtual const OptionParser* collectOptions() override {
+		return nullptr;
+	}
+
+	virtual int operator()(int argc, const char* argv[]) override;
+};
+
+#endif /* CLI_BASE_AUTOCOMPLETE_H_ */
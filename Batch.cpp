@@ -0,0 +1,253 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#include "CliApp.h"
+#include "Allocations.h"
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cctype>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <condition_variable>
+
+/**
+ * Hidden applet that runs a batch of command lines in a single process.
+ *
+ * Usage: _batch [<number of threads>]
+ *
+ * The command lines are read from the standard input, one per line, each
+ * starting with the name of the applet. The words are separated by white
+ * space, which can be included in a word using single or double quotes, or
+ * a backslash (like in the shell, but without any expansions).
+ *
+ * The jobs are executed on a pool of threads (as many as the hardware
+ * supports by default), with the output of each job captured separately.
+ * The results are written to the standard output in the order of the input
+ * as a header line followed by the captured output:
+ *
+ *     job <index> exit <code> stdout <length> stderr <length>
+ *     <standard output of the job><standard error of the job>
+ *
+ * Where the exit code is the value returned by the applet, the lengths are
+ * in bytes. Only the output written to the streams of the invocation is
+ * captured (see CliAppBase::out and CliAppBase::err), and the jobs can not
+ * read the standard input.
+ *
+ * Every job has its own applet object, so the response files it refers to
+ * are released when it finishes (see OptionParser::processArgs).
+ */
+struct BatchRunner: CliApp
+{
+	static constexpr const char* appName = "_batch";
+	static constexpr const char* appDesc = "Batch runner";
+
+	static inline CliApp& instance()
+	{
+		static BatchRunner instance;
+		return instance;
+	}
+
+	virtual ~BatchRunner() = default;
+
+	virtual int autocomplete(OptionParser::ArgIter from, OptionParser::ArgIter to, std::string_view word, const OptionParser::Sink& sink) override {
+		return -1;
+	}
+
+	virtual const OptionParser* collectOptions() override {
+		return nullptr;
+	}
+
+	struct Job
+	{
+		std::vector<std::string> words;
+		std::ostringstream out, err;
+		int ret = -1;
+		bool done = false;
+	};
+
+	/// Split a command line into words, returns false if a quote is not closed.
+	static inline bool split(const std::string& line, std::vector<std::string>& words)
+	{
+		std::string word;
+		bool inWord = false;
+		char quote = 0;
+
+		for(auto it = line.begin(); it != line.end(); it++)
+		{
+			const char c = *it;
+
+			if(quote)
+			{
+				if(c == quote)
+				{
+					quote = 0;
+				}
+				else if(c == '\\' && quote == '"' && it + 1 != line.end() && (it[1] == '"' || it[1] == '\\'))
+				{
+					word.push_back(*++it);
+				}
+				else
+				{
+					word.push_back(c);
+				}
+			}
+			else if(c == '\'' || c == '"')
+			{
+				quote = c;
+				inWord = true;
+			}
+			else if(c == '\\' && it + 1 != line.end())
+			{
+				word.push_back(*++it);
+				inWord = true;
+			}
+			else if(std::isspace(static_cast<unsigned char>(c)))
+			{
+				if(inWord)
+				{
+					words.push_back(std::move(word));
+					word.clear();
+					inWord = false;
+				}
+			}
+			else
+			{
+				word.push_back(c);
+				inWord = true;
+			}
+		}
+
+		if(inWord)
+		{
+			words.push_back(std::move(word));
+		}
+
+		return !quote;
+	}
+
+	static inline void run(Job& job)
+	{
+		if(job.words.empty())
+		{
+			job.err << "No operation requested." << std::endl;
+			return;
+		}
+
+		auto word = job.words.cbegin();
+		const auto& command = resolve(word, job.words.cend());
+		const auto app = command.entry;
+
+		if(!app)
+		{
+			job.err << "Unknown operation: '" << command.path << (command.path.empty() ? "" : " ") << (word != job.words.cend() ? *word : "") << "'" << std::endl;
+			return;
+		}
+
+		std::vector<const char*> argv;
+		for(; word != job.words.cend(); word++)
+		{
+			argv.push_back(word->c_str());
+		}
+
+		argv.push_back(nullptr);
+
+		const Allocations::Applet applet(app->name);
+
+		if(const auto ret = app->invoke(argv.size() - 1, argv.data(), job.out, job.err))
+		{
+			job.ret = *ret;
+		}
+		else
+		{
+			job.err << "Operation '" << app->name << "' can not be run in a batch" << std::endl;
+		}
+	}
+
+	virtual int operator()(int argc, const char* argv[]) override
+	{
+		const auto requested = (argc > 0) ? std::atoi(argv[0]) : 0;
+		const auto threads = (requested > 0) ? unsigned(requested) : std::max(1u, std::thread::hardware_concurrency());
+
+		std::vector<std::unique_ptr<Job>> jobs;
+
+		for(std::string line; std::getline(std::cin, line);)
+		{
+			jobs.push_back(std::make_unique<Job>());
+
+			if(!split(line, jobs.back()->words))
+			{
+				std::cerr << "Unterminated quote in line " << jobs.size() << std::endl;
+				return -1;
+			}
+		}
+
+		std::atomic<size_t> next = 0;
+		std::mutex mutex;
+		std::condition_variable finished;
+
+		std::vector<std::thread> pool;
+
+		for(auto i = 0u; i < std::min<size_t>(threads, jobs.size()); i++)
+		{
+			pool.emplace_back([&]()
+			{
+				for(size_t idx; (idx = next++) < jobs.size();)
+				{
+					run(*jobs[idx]);
+
+					std::lock_guard<std::mutex> lock(mutex);
+					jobs[idx]->done = true;
+					finished.notify_one();
+				}
+			});
+		}
+
+		// The results are written in order as they become available.
+		for(auto i = 0u; i < jobs.size(); i++)
+		{
+			auto& job = *jobs[i];
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				finished.wait(lock, [&job]() { return job.done; });
+			}
+
+			const auto out = job.out.str(), err = job.err.str();
+			std::cout << "job " << i << " exit " << job.ret << " stdout " << out.size() << " stderr " << err.size() << "\n" << out << err;
+			std::cout.flush();
+			jobs[i].reset();
+		}
+
+		for(auto& t: pool)
+		{
+			t.join();
+		}
+
+		return 0;
+	}
+};
+
+CLI_APP_REGISTER(BatchRunner, false);
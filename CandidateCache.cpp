@@ -0,0 +1,429 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#include "CandidateCache.h"
+#include "UnixServer.h"
+#include "Trace.h"
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+
+#include <cstdlib>
+
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+
+/// Create a private directory unless it exists already.
+static inline bool makeDirectory(const std::string& path) {
+	return mkdir(path.c_str(), 0700) == 0 || errno == EEXIST;
+}
+
+std::string CandidateCache::directory()
+{
+	std::string ret;
+
+	if(const auto cache = std::getenv("XDG_CACHE_HOME"); cache && *cache)
+	{
+		ret = cache;
+	}
+	else if(const auto home = std::getenv("HOME"); home && *home)
+	{
+		ret = std::string(home) + "/.cache";
+	}
+
+	UnixServer::BinaryStamp self;
+
+	if(ret.empty() || !self.loadSelf() || !makeDirectory(ret))
+	{
+		return {};
+	}
+
+	ret += "/cli-base";
+
+	if(!makeDirectory(ret))
+	{
+		return {};
+	}
+
+	ret += "/" + self.path.substr(self.path.rfind('/') + 1);
+
+	if(!makeDirectory(ret))
+	{
+		return {};
+	}
+
+	return ret;
+}
+
+/// Split the newline terminated candidates.
+static void split(const std::string& contents, std::list<std::string>& ret)
+{
+	for(size_t start = 0; start < contents.size();)
+	{
+		auto end = contents.find('\n', start);
+
+		if(end == std::string::npos)
+		{
+			end = contents.size();
+		}
+
+		ret.emplace_back(contents, start, end - start);
+		start = end + 1;
+	}
+}
+
+/// Join the candidates into newline terminated lines, the ones containing newlines are dropped.
+static std::string join(const std::list<std::string>& candidates)
+{
+	std::string ret;
+
+	for(const auto& c: candidates)
+	{
+		if(c.find('\n') == std::string::npos)
+		{
+			ret.append(c).append("\n");
+		}
+	}
+
+	return ret;
+}
+
+/// Write all of the data to a file, returns false on error.
+static bool writeAll(int fd, std::string_view data)
+{
+	while(!data.empty())
+	{
+		const auto n = write(fd, data.data(), data.size());
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(n <= 0)
+		{
+			return false;
+		}
+
+		data.remove_prefix(n);
+	}
+
+	return true;
+}
+
+/// Read the candidates from a cache file, returns false if there is none.
+static bool load(const std::string& path, std::list<std::string>& ret)
+{
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+	{
+		return false;
+	}
+
+	std::string contents;
+	const bool ok = UnixServer::readAll(fd, contents, 64 << 20);
+	close(fd);
+
+	split(contents, ret);
+	return ok;
+}
+
+/// Write the candidates to a temporary file and move it in place of the cache file.
+static void store(const std::string& path, const std::list<std::string>& candidates)
+{
+	const auto temp = path + "." + std::to_string(getpid());
+	const int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if(fd < 0)
+	{
+		return;
+	}
+
+	const bool written = writeAll(fd, join(candidates));
+
+	if(close(fd) != 0 || !written || rename(temp.c_str(), path.c_str()) != 0)
+	{
+		unlink(temp.c_str());
+	}
+}
+
+/**
+ * Read from a pipe until the writer closes it, but at most until the
+ * deadline. Returns true if the end was reached in time.
+ */
+static bool readUntil(int fd, std::string& out, std::chrono::steady_clock::time_point deadline)
+{
+	while(true)
+	{
+		const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+		if(left <= 0)
+		{
+			return false;
+		}
+
+		struct pollfd pfd = {fd, POLLIN, 0};
+		const auto n = poll(&pfd, 1, left);
+
+		if(n < 0 && errno != EINTR)
+		{
+			return false;
+		}
+
+		if(n > 0)
+		{
+			char buffer[4096];
+			const auto r = read(fd, buffer, sizeof(buffer));
+
+			if(r == 0)
+			{
+				return true;
+			}
+
+			if(r < 0 && errno != EINTR)
+			{
+				return false;
+			}
+
+			if(r > 0)
+			{
+				out.append(buffer, r);
+			}
+		}
+	}
+}
+
+/**
+ * Wait until the lock of another refresh is released, but at most until
+ * the deadline. Returns true if it was released in time.
+ */
+static bool waitForLock(int lock, std::chrono::steady_clock::time_point deadline)
+{
+	static constexpr auto interval = std::chrono::milliseconds(5);
+
+	while(flock(lock, LOCK_SH | LOCK_NB) != 0)
+	{
+		const auto now = std::chrono::steady_clock::now();
+
+		if(now >= deadline)
+		{
+			return false;
+		}
+
+		std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(interval, deadline - now));
+	}
+
+	return true;
+}
+
+/**
+ * Close the inherited file descriptors except for the standard streams and
+ * the listed ones, so that the generator does not keep the connections of
+ * the completing process (e.g. of the completion server) open.
+ */
+static void closeOtherFiles(std::initializer_list<int> keep)
+{
+	if(const auto dir = opendir("/proc/self/fd"))
+	{
+		std::vector<int> fds;
+
+		while(const auto e = readdir(dir))
+		{
+			const int fd = std::atoi(e->d_name);
+
+			if(fd > STDERR_FILENO && fd != dirfd(dir) && std::find(keep.begin(), keep.end(), fd) == keep.end())
+			{
+				fds.push_back(fd);
+			}
+		}
+
+		closedir(dir);
+
+		for(const auto fd: fds)
+		{
+			close(fd);
+		}
+	}
+}
+
+bool CandidateCache::refresh(const std::string& path, const Generator& generator, std::chrono::milliseconds wait)
+{
+	// The lock is held by the generator process until it exits.
+	const int lock = open((path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+	if(lock < 0)
+	{
+		return false;
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + wait;
+
+	// Another refresh is running, which is waited for the same way.
+	if(flock(lock, LOCK_EX | LOCK_NB) != 0)
+	{
+		const bool finished = waitForLock(lock, deadline);
+		close(lock);
+		return finished;
+	}
+
+	// The write end is only closed when the generator process exits, which is what is waited for.
+	int done[2];
+
+	if(pipe2(done, O_CLOEXEC) != 0)
+	{
+		close(lock);
+		return false;
+	}
+
+	// Double fork, so that the generator is not a child of the completing process.
+	const auto pid = fork();
+
+	if(pid == 0)
+	{
+		if(UnixServer::daemonize())
+		{
+			closeOtherFiles({lock, done[1]});
+
+#if __cpp_exceptions
+			try
+			{
+				store(path, generator());
+			}
+			catch(...) {}
+#else
+			store(path, generator());
+#endif
+		}
+
+		_exit(0);
+	}
+
+	close(done[1]);
+	close(lock);
+
+	if(pid < 0)
+	{
+		close(done[0]);
+		return false;
+	}
+
+	while(waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+
+	std::string ignored;
+	const bool finished = readUntil(done[0], ignored, deadline);
+
+	close(done[0]);
+	return finished;
+}
+
+std::list<std::string> CandidateCache::generate(const Generator& generator, std::chrono::milliseconds wait)
+{
+	const auto deadline = std::chrono::steady_clock::now() + wait;
+	std::list<std::string> ret;
+	int output[2];
+
+	if(pipe2(output, O_CLOEXEC) != 0)
+	{
+		return ret;
+	}
+
+	const auto pid = fork();
+
+	if(pid == 0)
+	{
+		closeOtherFiles({output[1]});
+
+#if __cpp_exceptions
+		try
+		{
+			writeAll(output[1], join(generator()));
+		}
+		catch(...) {}
+#else
+		writeAll(output[1], join(generator()));
+#endif
+
+		_exit(0);
+	}
+
+	close(output[1]);
+
+	if(pid < 0)
+	{
+		close(output[0]);
+		return ret;
+	}
+
+	std::string contents;
+	const bool finished = readUntil(output[0], contents, deadline);
+	close(output[0]);
+
+	// Nothing can be kept for the next time, so a late generator is stopped.
+	if(!finished)
+	{
+		kill(pid, SIGKILL);
+	}
+
+	while(waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+
+	if(finished)
+	{
+		split(contents, ret);
+	}
+
+	return ret;
+}
+
+std::list<std::string> CandidateCache::get(const std::string& name, const Generator& generator, std::chrono::seconds ttl, std::chrono::milliseconds deadline)
+{
+	Trace::Span span("candidateCache", name);
+
+	const auto dir = directory();
+
+	if(dir.empty())
+	{
+		return generate(generator, deadline);
+	}
+
+	const auto path = dir + "/" + name;
+	std::list<std::string> ret;
+	struct stat st;
+
+	if(stat(path.c_str(), &st) == 0)
+	{
+		if(std::chrono::system_clock::now() - std::chrono::system_clock::from_time_t(st.st_mtime) > ttl)
+		{
+			refresh(path, generator, std::chrono::milliseconds(0));
+		}
+
+		load(path, ret);
+	}
+	else if(refresh(path, generator, deadline))
+	{
+		load(path, ret);
+	}
+
+	return ret;
+}
@@ -0,0 +1,127 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#ifndef CLI_BASE_CANDIDATECACHE_H_
+#define CLI_BASE_CANDIDATECACHE_H_
+
+#include <list>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <type_traits>
+
+/**
+ * On-disk cache for expensive completion candidate generators.
+ *
+ * The candidates are stored per user under $XDG_CACHE_HOME (~/.cache by
+ * default), in a directory for the executable, one file per provider. The
+ * generator is never run by the completing process itself, but in a detached
+ * background process that writes the cache file, so the shell never waits
+ * for it longer than the deadline:
+ *
+ *  - if the cache is fresh its contents are used,
+ *  - if it is older than the TTL its contents are still used, and a refresh
+ *    is started in the background (stale-while-revalidate),
+ *  - if there is no cache yet the refresh is started and waited for until
+ *    the deadline, if it does not finish in time there are no candidates
+ *    this time, but the result is cached for the next request.
+ *
+ * Only one refresh runs at a time for a provider, if another process has
+ * started it the same deadline applies to waiting for that one. The
+ * candidates must not contain newlines (those are dropped).
+ */
+struct CandidateCache
+{
+	/// The generator of the candidates.
+	using Generator = std::function<std::list<std::string>()>;
+
+	/// Default time for which the cached candidates are used without refreshing.
+	static constexpr std::chrono::seconds defaultTtl{60};
+
+	/// Default time the completion waits for the generator if there is nothing cached.
+	static constexpr std::chrono::milliseconds defaultDeadline{150};
+
+	/**
+	 * Get the candidates of the named provider, see above. If the cache
+	 * directory is not available the generator is run in a child process,
+	 * which is waited for until the deadline (and stopped after that).
+	 */
+	static std::list<std::string> get(const std::string& name, const Generator& generator,
+			std::chrono::seconds ttl = defaultTtl, std::chrono::milliseconds deadline = defaultDeadline);
+
+	/**
+	 * Helper for implementing ArgumentParser<T>::suggest with a provider
+	 * class, for example:
+	 *
+	 *	struct Hosts
+	 *	{
+	 *		static constexpr const char* cacheName = "hosts";
+	 *		static std::list<std::string> generate();
+	 *	};
+	 *
+	 *	template<> struct ArgumentParser<Host>
+	 *	{
+	 *		static constexpr bool dynamicCandidates = true;
+	 *		static inline auto suggest() { return CandidateCache::suggest<Hosts>(); }
+	 *		...
+	 *	};
+	 *
+	 * The provider may also define _ttl_ and _deadline_ to override the defaults.
+	 */
+	template<class Provider>
+	static inline std::pair<int, std::list<std::string>> suggest()
+	{
+		std::chrono::seconds ttl = defaultTtl;
+		std::chrono::milliseconds deadline = defaultDeadline;
+
+		if constexpr(HasTtl<Provider>::value)
+		{
+			ttl = Provider::ttl;
+		}
+
+		if constexpr(HasDeadline<Provider>::value)
+		{
+			deadline = Provider::deadline;
+		}
+
+		return {0, get(Provider::cacheName, &Provider::generate, ttl, deadline)};
+	}
+
+	/// The directory of the cache files of the executable, empty if there is no such directory.
+	static std::string directory();
+
+private:
+	template<class T, class = void> struct HasTtl: std::false_type {};
+	template<class T> struct HasTtl<T, std::void_t<decltype(T::ttl)>>: std::true_type {};
+
+	template<class T, class = void> struct HasDeadline: std::false_type {};
+	template<class T> struct HasDeadline<T, std::void_t<decltype(T::deadline)>>: std::true_type {};
+
+	/**
+	 * Start a detached process that generates the candidates into the cache
+	 * file, unless one is already running. Waits for it for at most the
+	 * specified time, returns true if it finished in that time.
+	 */
+	static bool refresh(const std::string& path, const Generator& generator, std::chrono::milliseconds wait);
+
+	/// Run the generator in a child process and collect its candidates, if it finishes within the specified time.
+	static std::list<std::string> generate(const Generator& generator, std::chrono::milliseconds wait);
+};
+
+#endif /* CLI_BASE_CANDIDATECACHE_H_ */
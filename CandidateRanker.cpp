@@ -0,0 +1,172 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#include "CandidateRanker.h"
+#include "Levenshtein.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+/// Tiers of the kinds of matches.
+enum Tier: int
+{
+	Typo = 0,
+	Subsequence = 1,
+	Prefix = 2,
+};
+
+bool CandidateRanker::Entry::operator<(const Entry& o) const {
+	return tier > o.tier || (tier == o.tier && (score > o.score || (score == o.score && text < o.text)));
+}
+
+/*
+ * Unlike for the suggestions of unknown commands (see SuggestionIndex) there
+ * is no minimum of one edit, words shorter than three characters would be
+ * a typo away from most of the short candidates.
+ */
+CandidateRanker::CandidateRanker(std::string_view word, size_t count):
+	word(word), count(count), maxDistance(word.length() / 3) {}
+
+/// Whether the character separates the words of a name (so a match after it is likely intended).
+static inline bool isBoundary(char c) {
+	return c == '-' || c == '_' || c == '.' || c == '/' || c == ' ';
+}
+
+bool CandidateRanker::rank(std::string_view candidate, int minTier, int& tier, long& score) const
+{
+	if(candidate.length() >= word.length() && std::memcmp(candidate.data(), word.data(), word.length()) == 0)
+	{
+		tier = Prefix;
+		score = -long(candidate.length());
+		return true;
+	}
+
+	if(havePrefixMatch || word.empty() || minTier > Subsequence)
+	{
+		return false;
+	}
+
+	// The characters of the word in order, contiguous runs and the starts of words score higher.
+	score = 0;
+	size_t pos = 0;
+	bool matched = true;
+
+	for(size_t i = 0; i < word.length(); i++)
+	{
+		const auto idx = candidate.find(word[i], pos);
+
+		if(idx == std::string_view::npos)
+		{
+			matched = false;
+			break;
+		}
+
+		score += 1;
+
+		if(i && idx == pos)
+		{
+			score += 4;
+		}
+
+		if(idx == 0 || isBoundary(candidate[idx - 1]))
+		{
+			score += 3;
+		}
+
+		score -= long(idx - pos);
+		pos = idx + 1;
+	}
+
+	if(matched)
+	{
+		tier = Subsequence;
+		score -= long(candidate.length() - pos);
+		return true;
+	}
+
+	if(maxDistance && minTier <= Typo)
+	{
+		const auto distance = levenshteinDistance(word, candidate.substr(0, word.length()), maxDistance);
+
+		if(distance <= maxDistance)
+		{
+			tier = Typo;
+			score = -long(distance);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CandidateRanker::offer(std::string_view candidate)
+{
+	int tier;
+	long score;
+
+	if(!count)
+	{
+		return;
+	}
+
+	// Tiers below the worst entry kept need not be computed once the heap is full.
+	const int minTier = (heap.size() < count) ? int(Typo) : heap.front().tier;
+
+	if(!rank(candidate, minTier, tier, score))
+	{
+		return;
+	}
+
+	if(tier == Prefix && !havePrefixMatch)
+	{
+		havePrefixMatch = true;
+		heap.erase(std::remove_if(heap.begin(), heap.end(), [](const Entry& e) { return e.tier != Prefix; }), heap.end());
+		std::make_heap(heap.begin(), heap.end());
+	}
+
+	if(heap.size() < count)
+	{
+		heap.push_back({tier, score, std::string(candidate)});
+		std::push_heap(heap.begin(), heap.end());
+		return;
+	}
+
+	// The worst entry kept is on the top of the heap, the candidate is only copied if it is better.
+	const auto& worst = heap.front();
+
+	if(tier > worst.tier || (tier == worst.tier && (score > worst.score || (score == worst.score && candidate < worst.text))))
+	{
+		std::pop_heap(heap.begin(), heap.end());
+		heap.back() = {tier, score, std::string(candidate)};
+		std::push_heap(heap.begin(), heap.end());
+	}
+}
+
+void CandidateRanker::emit(const std::function<void(std::string_view)>& sink)
+{
+	std::sort_heap(heap.begin(), heap.end());
+
+	for(const auto& e: heap)
+	{
+		sink(e.text);
+	}
+
+	heap.clear();
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#ifndef CLI_BASE_CANDIDATERANKER_H_
+#define CLI_BASE_CANDIDATERANKER_H_
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <string_view>
+
+/**
+ * Incremental filter and ranking of completion candidates for the word
+ * under the cursor, keeping only the best ones.
+ *
+ * Candidates starting with the word are preferred (shorter ones first).
+ * If there are no such candidates, the ones that contain the characters
+ * of the word in order (scored by how contiguous the match is) and then
+ * the ones that start with a few typos are offered instead, so that the
+ * shell can correct the word if there is a single match.
+ *
+ * The candidates are offered one by one and only the best ones are kept
+ * in a bounded heap, those that can not make it into the result are not
+ * copied, so the memory used is independent of the number of candidates.
+ */
+class CandidateRanker
+{
+	struct Entry
+	{
+		/// Kind of the match, prefix matches are better than fuzzy ones.
+		int tier;
+
+		/// Score within the tier, higher is better.
+		long score;
+
+		std::string text;
+
+		/// Whether this entry is ranked higher than the other one.
+		bool operator<(const Entry& o) const;
+	};
+
+	const std::string word;
+	const size_t count;
+	const size_t maxDistance;
+
+	/// Min heap of the best entries (the worst one is on the top).
+	std::vector<Entry> heap;
+
+	/// Set once a prefix match is found, after which only those are considered.
+	bool havePrefixMatch = false;
+
+	/**
+	 * Compute the tier and score of a candidate, returns false if it does
+	 * not match at all or only in a tier below the minimum.
+	 */
+	bool rank(std::string_view candidate, int minTier, int& tier, long& score) const;
+
+public:
+	/// Default number of candidates kept.
+	static constexpr size_t defaultCount = 1000;
+
+	CandidateRanker(std::string_view word, size_t count = defaultCount);
+
+	/// Consider a candidate.
+	void offer(std::string_view candidate);
+
+	/// Pass the kept candidates to the sink, best first (ties in alphabetical order).
+	void emit(const std::function<void(std::string_view)>& sink);
+};
+
+#endif /* CLI_BASE_CANDIDATERANKER_H_ */
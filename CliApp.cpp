@@ -18,60 +18,211 @@
  *******************************************************************************/
 
 #include "CliApp.h"
-#include "Levenshtein.h"
+#include "SuggestionIndex.h"
+#include "Trace.h"
+#include "Zygote.h"
 
+#include <map>
+#include <mutex>
+#include <vector>
 #include <iostream>
 #include <algorithm>
 #include <iterator>
 #include <numeric>
+#include <cstring>
 
 #include <libgen.h>
 
 static constexpr const char* showAllEnvVarName = "CLI_BASE_SHOW_ALL";
 
-int CliApp::main(int argc, const char* argv[])
+/// Bounds of the registry section, provided by the linker.
+extern "C" CliApp::Entry __start_cli_base_apps[] __attribute__((weak));
+extern "C" CliApp::Entry __stop_cli_base_apps[] __attribute__((weak));
+
+std::pair<const CliApp::Entry*, const CliApp::Entry*> CliApp::registry()
 {
-	const bool allVisible = std::getenv(showAllEnvVarName);
+	static const bool sorted = (Trace::Span("registry"), std::sort(__start_cli_base_apps, __stop_cli_base_apps, [](const auto& a, const auto& b) {
+		return std::strcmp(a.name, b.name) < 0;
+	}), true);
+
+	(void)sorted;
+	return {__start_cli_base_apps, __stop_cli_base_apps};
+}
+
+const CliApp::Command& CliApp::commands()
+{
+	static const auto tree = []()
+	{
+		const auto apps = registry();
+		Trace::Span span("commands");
+
+		// Every node is a prefix of an applet name, so there are at most as many nodes as words.
+		size_t words = 1;
+		for(auto it = apps.first; it != apps.second; it++)
+		{
+			words += 1 + std::count(it->name, it->name + std::strlen(it->name), ' ');
+		}
+
+		// Nothing is reallocated, so the nodes can refer to each other.
+		std::vector<Command> ret;
+		ret.reserve(words);
+		ret.push_back({{}, {}, nullptr, apps.first, apps.second, nullptr, nullptr});
+
+		// Breadth first, so that the subcommands of a node are added together.
+		for(size_t i = 0; i < ret.size(); i++)
+		{
+			auto& node = ret[i];
+			const auto prefix = node.path.empty() ? 0 : node.path.length() + 1;
+			auto app = node.firstApp;
+
+			// The name of the applet of the node itself is the shortest one, so it is the first (duplicates are ignored).
+			if(!node.path.empty())
+			{
+				for(; app != node.lastApp && app->name == node.path; app++)
+				{
+					node.entry = node.entry ? node.entry : app;
+				}
+			}
+
+			node.firstChild = ret.data() + ret.size();
+
+			while(app != node.lastApp)
+			{
+				const auto rest = std::string_view(app->name).substr(prefix);
+				const auto word = rest.substr(0, rest.find(' '));
+				const auto first = app;
 
-	std::list<std::pair<std::string, CliApp*>> visibleApps;
-	std::copy_if(CliApp::apps.begin(), CliApp::apps.end(), std::back_inserter(visibleApps), [allVisible](const auto& p) {
-		return p.second->visibleByDefault() || allVisible;
+				// The names are sorted and the space is ordered before the other characters, so the group is contiguous.
+				while(app != node.lastApp && std::string_view(app->name).substr(prefix, word.length()) == word
+						&& (app->name[prefix + word.length()] == '\0' || app->name[prefix + word.length()] == ' '))
+				{
+					app++;
+				}
+
+				ret.push_back({std::string_view(first->name, prefix + word.length()), word, nullptr, first, app, nullptr, nullptr});
+			}
+
+			node.lastChild = ret.data() + ret.size();
+		}
+
+		return ret;
+	}();
+
+	return tree.front();
+}
+
+const CliApp::Command* CliApp::Command::find(std::string_view word) const
+{
+	const auto it = std::lower_bound(firstChild, lastChild, word, [](const auto& c, const auto& w) {
+		return c.word < w;
 	});
 
-	if(argc > 1)
+	if(it != lastChild && it->word == word)
 	{
-		const auto requested = argv[1];
-		if(auto it = CliApp::apps.find(requested); it != CliApp::apps.end())
+		return it;
+	}
+
+	return nullptr;
+}
+
+bool CliApp::Command::visible() const {
+	return std::any_of(firstApp, lastApp, [](const auto& e) { return e.visible; });
+}
+
+const SuggestionIndex& CliApp::suggestionIndex(const Command& node, bool allVisible)
+{
+	static std::mutex mutex;
+	static std::map<std::pair<const Command*, bool>, SuggestionIndex> indexes;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(const auto it = indexes.find({&node, allVisible}); it != indexes.end())
+	{
+		return it->second;
+	}
+
+	std::vector<std::string_view> words;
+
+	for(auto it = node.firstChild; it != node.lastChild; it++)
+	{
+		if(allVisible || it->visible())
 		{
-			return (*it->second)(argc - 2, argv + 2);
+			words.push_back(it->word);
 		}
-		else
+	}
+
+	return indexes.try_emplace({&node, allVisible}, words.begin(), words.end()).first->second;
+}
+
+int CliApp::main(int argc, const char* argv[])
+{
+	Trace::Span span("main");
+
+	if(std::getenv(Zygote::envVarName))
+	{
+		if(const auto ret = Zygote::forward(argc, argv))
 		{
-			std::cerr << "Unknown operation: '" << argv[1] << "'" << std::endl;
+			return *ret;
+		}
+	}
 
-			std::list<std::pair<size_t, std::string>> lDists;
-			std::transform(visibleApps.begin(), visibleApps.end(), std::back_inserter(lDists), [requested](const auto& l) {
-				return std::make_pair(levenshteinDistance(requested, l.first), l.first);
-			});
+	return dispatch(argc, argv);
+}
+
+int CliApp::dispatch(int argc, const char* argv[])
+{
+	const bool allVisible = std::getenv(showAllEnvVarName);
 
-			const auto suggested = std::min_element(lDists.begin(), lDists.end(), [](const auto& a, const auto& b){return a.first < b.first;});
+	const auto end = argv + argc;
+	auto it = argv + (argc > 0);
+	const auto& command = resolve(it, end);
 
-			std::cerr << std::endl << "Did you mean: " << suggested->second << "?" << std::endl;
+	if(const auto app = command.entry)
+	{
+		const Allocations::Applet applet(app->name);
+
+		// The applets with an option parser run on a new object, the singleton is not needed.
+		if(const auto ret = app->invoke(end - it, it, std::cout, std::cerr))
+		{
+			return *ret;
 		}
+
+		auto& instance = (Trace::Span("construct", app->name), app->instance());
+
+		Trace::Span span("applet", app->name);
+		return instance(end - it, it);
+	}
+
+	if(it != end)
+	{
+		const auto requested = *it;
+		std::cerr << "Unknown operation: '" << command.path << (command.path.empty() ? "" : " ") << requested << "'" << std::endl;
+
+		Trace::Span span("suggestions", requested);
+		printSuggestions(std::cerr, suggestionIndex(command, allVisible).query(requested));
 	}
 	else
 	{
 		std::cerr << "No operation requested." << std::endl;
-		std::cerr << std::endl << "Usage: " << basename(const_cast<char*>(argv[0])) << " <operation> [options]" << std::endl;
+		std::cerr << std::endl << "Usage: " << basename(const_cast<char*>(argv[0])) << " " << command.path << (command.path.empty() ? "" : " ") << "<operation> [options]" << std::endl;
 		std::cerr << std::endl << "Available operations:" << std::endl << std::endl;
 
+		std::list<const Entry*> visibleApps;
+		for(auto it = command.firstApp; it != command.lastApp; it++)
+		{
+			if(it->visible || allVisible)
+			{
+				visibleApps.push_back(it);
+			}
+		}
+
 		const auto maxLen = std::accumulate(visibleApps.begin(), visibleApps.end(), size_t(0), [](size_t l, const auto& p) {
-			return std::max(l, p.first.length());
+			return std::max(l, std::strlen(p->name));
 		});
 
 		std::transform(visibleApps.begin(), visibleApps.end(), std::ostream_iterator<std::string>(std::cerr, "\n"), [maxLen](const auto& l)
 		{
-			return std::string(maxLen + 6 - l.first.length(), ' ') + l.first + "  -  " + l.second->getDesc();
+			return std::string(maxLen + 6 - std::strlen(l->name), ' ') + l->name + "  -  " + l->desc;
 		});
 
 		std::cerr << std::endl << std::endl;
@@ -22,10 +22,20 @@
 
 #include "OptionParser.h"
 
-#include <map>
 #include <set>
 #include <list>
 #include <string>
+#include <ostream>
+#include <optional>
+#include <iostream>
+#include <utility>
+#include <type_traits>
+#include <string_view>
+
+#include <unistd.h>
+
+/// Name of the linker section that holds the applet registry.
+#define CLI_APP_SECTION "cli_base_apps"
 
 /**
  * Polymorphic top level base class (and static registry) for all utility applets.
@@ -33,73 +43,202 @@
 class CliApp
 {
 	friend int main(int argc, const char* argv[]);
-	friend class Autocompleter;
+	friend struct Autocompleter;
+	friend struct ManifestExporter;
+	friend struct ZygoteServer;
+	friend struct BatchRunner;
 
-	/// Global registry of applets.
-	static inline std::map<std::string, class CliApp*> apps;
+public:
+	/**
+	 * Registry entry of an applet.
+	 *
+	 * Entries are constant initialized and placed in a dedicated linker
+	 * section by the CLI_APP_REGISTER macro, the linker collects them into
+	 * a contiguous array, so registration involves no code at startup. The
+	 * applet object itself is only constructed when it is first used.
+	 *
+	 * The alignment is set to the size, so that the compiler can not insert
+	 * padding between entries coming from different compilation units.
+	 */
+	struct alignas(8 * sizeof(void*)) Entry
+	{
+		/// Name used to invoke the applet, the words of a subcommand path are separated by single spaces (like "remote add").
+		const char* name;
+
+		/// Description of the applet.
+		const char* desc;
+
+		/// Whether the applet should be visible.
+		bool visible;
+
+		/// Accessor for the (lazily constructed) applet instance, used for collecting the options.
+		CliApp& (*instance)();
+
+		/**
+		 * Run the applet on a new object, with its output going to the
+		 * specified streams, without constructing the instance. Returns
+		 * an empty optional for applets that do not support it (the hidden
+		 * ones), those are run by the instance.
+		 */
+		std::optional<int> (*invoke)(int argc, const char* argv[], std::ostream& out, std::ostream& err);
+	};
+
+	static_assert(sizeof(Entry) == alignof(Entry));
+
+private:
+	/**
+	 * Node of the command tree.
+	 *
+	 * The tree has a node for every prefix of the applet names (whole words),
+	 * so a node either invokes an applet, groups subcommands or both. It is
+	 * built once, at first use, from the sorted registry into a single array,
+	 * in which the subcommands of a node are contiguous and sorted, so that
+	 * resolving a command line takes a binary search among the siblings per
+	 * word, regardless of the number of commands elsewhere in the tree.
+	 */
+	struct Command
+	{
+		/// The words leading to the node (empty for the root).
+		std::string_view path;
 
-	/// Entry point of an applet.
-	virtual int operator()(int argc, const char* argv[]) = 0;
+		/// The last word of the path.
+		std::string_view word;
 
-	/// Get description of the applet.
-	virtual const char* getDesc() const = 0;
+		/// The applet invoked by the path, null if the node only groups subcommands.
+		const Entry* entry;
 
-	/// Get whether the applet should be visible.
-	virtual bool visibleByDefault() const = 0;
+		/// The applets at or below the node (a contiguous range of the sorted registry).
+		const Entry *firstApp, *lastApp;
 
-	/// Autocompletion entry point.
-	virtual std::pair<int, std::list<std::string>> autocomplete(std::list<std::string>::const_iterator from, std::list<std::string>::const_iterator to) = 0;
+		/// The subcommands, sorted by word.
+		const Command *firstChild, *lastChild;
 
-protected:
-	/// Registers an applet in the global registry.
-	inline CliApp(const char* name) {
-		apps.insert({name, this});
+		/// Find a subcommand by its word, returns null if there is no such subcommand.
+		const Command* find(std::string_view word) const;
+
+		/// Whether there are any visible applets at or below the node.
+		bool visible() const;
+	};
+
+	/// Get the registered applets, sorted by name (sorting is done at first use).
+	static std::pair<const Entry*, const Entry*> registry();
+
+	/// Get the root of the command tree (built at first use).
+	static const Command& commands();
+
+	/**
+	 * Follow the words of a command line down the command tree as long as
+	 * they name subcommands, the iterator is moved past the words used.
+	 */
+	template<class It>
+	static inline const Command& resolve(It& it, const It& end)
+	{
+		auto ret = &commands();
+
+		while(it != end)
+		{
+			if(const auto sub = ret->find(*it))
+			{
+				ret = sub;
+				it++;
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		return *ret;
 	}
 
+	/// Get the suggestion index of the subcommands of a node (including hidden ones or not), built at first use.
+	static const class SuggestionIndex& suggestionIndex(const Command& node, bool allVisible);
+
+	/// Run the applet selected by the command line (the part of main after the zygote client).
+	static int dispatch(int argc, const char* argv[]);
+
+	/// Entry point of an applet.
+	virtual int operator()(int argc, const char* argv[]) = 0;
+
+	/**
+	 * Autocompletion entry point, the arguments are the words before the
+	 * one to be completed, which is also passed for in-process completion.
+	 * The candidates are passed to the sink (unfiltered unless the code is
+	 * 3), the return value is the code interpreted by the completion script.
+	 */
+	virtual int autocomplete(OptionParser::ArgIter from, OptionParser::ArgIter to, std::string_view word, const OptionParser::Sink& sink) = 0;
+
+	/**
+	 * Get the options of the applet, collected by a dry run of the applet if
+	 * needed. Returns null for applets that do not use an option parser.
+	 */
+	virtual const OptionParser* collectOptions() = 0;
+
 public:
 	virtual ~CliApp() = default;
 	static int main(int argc, const char* argv[]);
+
+	/// Registry entry point of the applets that can only be run by their instance (see Entry::invoke).
+	static inline std::optional<int> invoke(int, const char*[], std::ostream&, std::ostream&) {
+		return std::nullopt;
+	}
 };
 
 /**
- * CRTP intermediate base for applets that provides static instance.
+ * Place a registry entry for an applet into the applet registry section.
+ *
+ * The applet class must provide a static _instance_ method that returns
+ * the applet object as a CliApp reference, and may provide a static
+ * _invoke_ method (see CliApp::Entry) to run on a new object instead.
+ */
+#define CLI_APP_REGISTER(type, visible)													\
+alignas(::CliApp::Entry) static ::CliApp::Entry cliAppEntry_##type						\
+	__attribute__((section(CLI_APP_SECTION), used)) =									\
+		{type::appName, type::appDesc, visible, &type::instance, &type::invoke}
+
+/**
+ * Trait to detect whether an applet declares its options separately.
+ *
+ * Applets can define a public method called declareOptions that registers
+ * all of their options, in which case it is called before the body of the
+ * applet for every invocation, and the auxiliary functions (completion,
+ * manifest export) use it to learn the options instead of a dry run of
+ * the applet body.
+ */
+template<class T, class = void> struct HasDeclaredOptions: std::false_type {};
+
+template<class T>
+struct HasDeclaredOptions<T, std::void_t<decltype(std::declval<T&>().declareOptions())>>: std::true_type {};
+
+/**
+ * CRTP intermediate base for applets that provides the lazily
+ * constructed singleton instance.
  *
- * NOTE: The constructor of the subclass must call the dummy method
- * on the instance member in order for the automatic inclusion in
- * the final binary to happen.
+ * The singleton is only used to collect the options for the auxiliary
+ * functions, every invocation of the applet runs on a separate object,
+ * so the parser state is private to the invocation.
  */
 template<class Child>
 class CliAppBase: CliApp, OptionParser
 {
-	/// Stored arguments, for applet processing.
-	std::list<std::string> args;
+	/// Stored arguments (views of argv), for applet processing.
+	Arguments args;
+
+	/// Stream for the output of the invocation.
+	std::ostream* outStream = &std::cout;
 
 	/// Makes processCommandLine return error no matter what.
 	bool dryRun = false;
 
-	/// Forward description of the applet from CRTP child.
-	virtual const char* getDesc() const final override {
-		return Child::appDesc;
-	}
-
-	/// Forward visibility information of the applet from CRTP child.
-	virtual bool visibleByDefault() const final override {
-		return true;
-	}
+	/// Set once the options have been registered by a dry run of the applet.
+	bool optionsCollected = false;
 
 protected:
-	/// Static (singleton) instance of the applet class.
-	static inline Child instance;
-
-	/// Linker hack: must be called from constructor of applet subclass.
-	inline void dummy() {}
-
 	/// Constructor that forwards static applet name and description strings from Child class.
-	inline CliAppBase(): CliApp(Child::appName),
-		OptionParser(std::string(Child::appDesc) + "\nUsage: " + Child::appName + " [options]")  {}
+	inline CliAppBase(): OptionParser(std::string(Child::appDesc) + "\nUsage: " + Child::appName + " [options]")  {}
 
 	/// Process stored arguments (proxy for child)
-	inline std::optional<std::list<std::string>> processCommandLine()
+	inline std::optional<Arguments> processCommandLine()
 	{
 		if(dryRun)
 		{
@@ -109,71 +248,160 @@ protected:
 		return this->processArgs(args);
 	}
 
+	/**
+	 * Process stored arguments, passing the non-option arguments to the sink
+	 * as they are parsed (proxy for child). If _readStdin_ is set, the sink is
+	 * then also fed with the NUL delimited items read from the standard input.
+	 *
+	 * Returns false on error, in which case the applet must return an error
+	 * value immediately (as for the other overload).
+	 */
+	inline bool processCommandLine(const Sink& sink, bool readStdin = false)
+	{
+		if(dryRun)
+		{
+			return false;
+		}
+
+		return this->processArgs(args, sink) && (!readStdin || readItems(STDIN_FILENO, sink, *errorStream));
+	}
+
+	/// Output stream of the invocation, the applet should write its output here.
+	inline std::ostream& out() {
+		return *outStream;
+	}
+
+	/// Error stream of the invocation, the applet should write its diagnostics here.
+	inline std::ostream& err() {
+		return *errorStream;
+	}
+
 	/// Entry point of the applet.
-	inline virtual int operator()(int argc, const char* argv[]) final override
+	inline virtual int operator()(int argc, const char* argv[]) final override {
+		return *invoke(argc, argv, std::cout, std::cerr);
+	}
+
+	/// Option collection entry point, the options are collected once and kept in the singleton.
+	inline virtual const OptionParser* collectOptions() final override
 	{
-		args = {argv, argv + argc};
-		return static_cast<Child*>(this)->run();
+		if(!optionsCollected)
+		{
+			if constexpr(HasDeclaredOptions<Child>::value)
+			{
+				static_cast<Child*>(this)->declareOptions();
+			}
+			else
+			{
+				dryRun = true;
+				static_cast<Child*>(this)->run();
+			}
+
+			optionsCollected = true;
+		}
+
+		return this;
 	}
 
 	/// Autocompletion entry point.
-	inline virtual std::pair<int, std::list<std::string>> autocomplete(std::list<std::string>::const_iterator from, std::list<std::string>::const_iterator to) final override
+	inline virtual int autocomplete(ArgIter from, ArgIter to, std::string_view word, const Sink& sink) final override
 	{
-		dryRun = true;
-		static_cast<Child*>(this)->run();
+		collectOptions();
 
-		std::set<std::shared_ptr<Option>> opts;
+		std::set<Option*> opts;
 		std::transform(options.begin(), options.end(), std::inserter(opts, opts.begin()), [](const auto& p) {return p.second; });
 
 		for(auto it = from; it != to; )
 		{
-			if(auto oit = options.find(*it++); oit != options.end())
+			if(auto opt = findOption(*it++))
 			{
-				if(auto ret = oit->second->suggest(it, to))
+				if(const auto end = opt->variadic ? variadicEnd(it, to) : to; end != to)
 				{
-					return *ret;
+					// The values of a variadic option end before the word to be completed.
+					it = (*end == "--") ? end + 1 : end;
+				}
+				else if(auto ret = opt->suggest(it, to, word))
+				{
+					for(const auto& c: ret->second)
+					{
+						sink(c);
+					}
+
+					return ret->first;
 				}
 
-				opts.erase(oit->second);
+				opts.erase(opt);
 			}
 		}
 
-		std::list<std::string> ret;
-
-		for(const auto &opt: opts)
+		for(const auto &o: options)
 		{
-			for(const auto &o: options)
+			if(opts.count(o.second))
 			{
-				if(o.second == opt)
-				{
-					ret.push_back(o.first);
-				}
+				sink(o.first);
 			}
 		}
 
-		return {0, ret};
+		return 0;
 	}
 
 public:
 	using OptionParser::addOption;
 	using OptionParser::addOptions;
 
+	/// Static (singleton) instance of the applet class, constructed at first use.
+	static inline ::CliApp& instance()
+	{
+		static Child instance;
+		return instance;
+	}
+
+	/**
+	 * Run the applet on a new object, with the specified output streams.
+	 *
+	 * Invocations are independent of each other (and of the singleton),
+	 * so this can be called repeatedly and concurrently.
+	 */
+	static inline std::optional<int> invoke(int argc, const char* argv[], std::ostream& out, std::ostream& err)
+	{
+		std::optional<Child> object;
+		(Trace::Span("construct", Child::appName), object.emplace());
+
+		auto& invocation = *object;
+		invocation.args.assign(argv, argv + argc);
+		invocation.outStream = &out;
+		invocation.errorStream = &err;
+
+		if constexpr(HasDeclaredOptions<Child>::value)
+		{
+			invocation.declareOptions();
+		}
+
+		Trace::Span span("applet", Child::appName);
+		return invocation.run();
+	}
+
 	virtual ~CliAppBase() = default;
 };
 
-#define CLI_APP(name, desc)												\
-struct CliApp_##name: CliAppBase<CliApp_##name>  						\
+/**
+ * Define a subcommand, invoked by a path of words separated by single
+ * spaces (like "remote add"), the identifier only names the class.
+ */
+#define CLI_SUBCOMMAND(id, path, desc)									\
+struct CliApp_##id: CliAppBase<CliApp_##id>  							\
 {																		\
-	static constexpr const char* appName = #name;						\
+	static constexpr const char* appName = path;						\
 	static constexpr const char* appDesc = desc;						\
-	virtual ~CliApp_##name() = default;									\
-																		\
-	CliApp_##name() {	 CliAppBase::instance.CliAppBase::dummy(); } 	\
+	virtual ~CliApp_##id() = default;									\
 																		\
     int run();															\
 };																		\
 																		\
-int CliApp_##name::run()
+CLI_APP_REGISTER(CliApp_##id, true);									\
+																		\
+int CliApp_##id::run()
+
+#define CLI_APP(name, desc) CLI_SUBCOMMAND(name, #name, desc)
 
 
 #endif /* CLI_BASE_CLIAPP_H_ */
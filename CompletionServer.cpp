@@ -0,0 +1,190 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+
+#include "Autocomplete.h"
+#include "UnixServer.h"
+
+#include <string>
+#include <cstdlib>
+
+/**
+ * Hidden applet that runs a resident completion server.
+ *
+ * Listens on a unix domain socket and answers completion requests using
+ * the same logic as the _autocomplete applet, but without the process
+ * startup and the dry run of the target applet (the applets and their
+ * option tables are kept in memory between requests).
+ *
+ * A request consists of NUL terminated fields: the working directory of
+ * the shell, the number of environment variables, the variables (so that
+ * the candidates are the same as the _autocomplete applet would generate
+ * in the shell) and the arguments of the _autocomplete applet. The
+ * client half-closes the connection after sending it. The reply is the
+ * return code on the first line, followed by the candidates (or the same
+ * with NUL delimiters if the NUL delimited format is requested).
+ *
+ * The requests are served one at a time, so the connections time out
+ * like the client does, a stuck client can not block the server.
+ *
+ * The server exits if it receives no request for the idle timeout, or if
+ * the binary it was started from is replaced, in which case the request
+ * is dropped without a reply and the client is expected to fall back to
+ * invoking the _autocomplete applet.
+ */
+struct CompletionServer: CliApp, UnixServer
+{
+	static constexpr const char* appName = "_autocomplete_server";
+	static constexpr const char* appDesc = "Resident autocomplete server";
+
+	/// Default number of seconds without requests after which the server exits.
+	static constexpr int defaultIdleSeconds = 600;
+
+	/// Seconds a connection may take to send its request or receive the reply, like the client waits.
+	static constexpr int connectionTimeoutSeconds = 2;
+
+	/// Maximum size of a request.
+	static constexpr size_t maxRequestSize = 1 << 20;
+
+	static inline CliApp& instance()
+	{
+		static CompletionServer instance;
+		return instance;
+	}
+
+	virtual ~CompletionServer() = default;
+
+	virtual int autocomplete(OptionParser::ArgIter from, OptionParser::ArgIter to, std::string_view word, const OptionParser::Sink& sink) override {
+		return -1;
+	}
+
+	virtual const OptionParser* collectOptions() override {
+		return nullptr;
+	}
+
+	static inline void serve(int fd)
+	{
+		std::string request;
+
+		if(!readAll(fd, request, maxRequestSize) || request.empty() || request.back() != '\0')
+		{
+			return;
+		}
+
+		OptionParser::Arguments fields;
+
+		for(std::string_view rest = request; !rest.empty();)
+		{
+			const auto end = rest.find('\0');
+			fields.push_back(rest.substr(0, end));
+			rest.remove_prefix(end + 1);
+		}
+
+		const auto envc = parseNumber<size_t>((fields.size() > 1) ? fields[1] : std::string_view{}, "environment size");
+
+		if(!envc || fields.size() < 2 + *envc || chdir(std::string(fields.front()).c_str()) != 0)
+		{
+			return;
+		}
+
+		// The fields are views of the NUL terminated request, so they can be used in place.
+		clearenv();
+
+		for(auto it = fields.begin() + 2; it != fields.begin() + 2 + *envc; it++)
+		{
+			putenv(const_cast<char*>(it->data()));
+		}
+
+		const auto args = fields.begin() + 2 + *envc;
+		const bool nulDelimited = args != fields.end() && *args == Autocompleter::nulDelimitedFlag;
+		const auto delimiter = nulDelimited ? '\0' : '\n';
+
+		std::string out;
+		const auto ret = Autocompleter::complete(OptionParser::Arguments(args + nulDelimited, fields.end()), out, delimiter);
+
+		// The environment refers to the request, which goes away.
+		clearenv();
+
+		writeAll(fd, std::to_string(ret) + delimiter) && writeAll(fd, out);
+	}
+
+	virtual int operator()(int argc, const char* argv[]) override
+	{
+		if(argc < 1)
+		{
+			return -1;
+		}
+
+		const std::string path = argv[0];
+		const int idleSeconds = (argc > 1) ? std::atoi(argv[1]) : defaultIdleSeconds;
+
+		BinaryStamp started;
+
+		if(!started.loadSelf())
+		{
+			return -1;
+		}
+
+		const int listenFd = listenOn(path);
+
+		if(listenFd < 0)
+		{
+			return -1;
+		}
+
+		if(!daemonize())
+		{
+			close(listenFd);
+			return 0;
+		}
+
+		while(waitForClient(listenFd, idleSeconds))
+		{
+			const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+			if(fd < 0)
+			{
+				continue;
+			}
+
+			BinaryStamp current{started.path};
+
+			if(!current.load() || !(current == started))
+			{
+				unlink(path.c_str());
+				close(listenFd);
+				close(fd);
+				std::_Exit(0);
+			}
+
+			if(sameUser(fd) && setTimeout(fd, connectionTimeoutSeconds))
+			{
+				serve(fd);
+			}
+
+			close(fd);
+		}
+
+		unlink(path.c_str());
+		close(listenFd);
+		std::_Exit(0);
+	}
+};
+
+CLI_APP_REGISTER(CompletionServer, false);
@@ -17,32 +17,321 @@
  *
  *******************************************************************************/
 
+
 #include "Levenshtein.h"
 
-#include <string>
 #include <memory>
+#include <cstring>
 #include <algorithm>
 
-size_t levenshteinDistance(std::string_view a, std::string_view b)
+/*
+ * Bit-parallel edit distance computation (Myers' algorithm in Hyyrö's
+ * formulation), the vertical differences of a column of the dynamic
+ * programming matrix are stored in bit vectors, one bit per character of
+ * the shorter string (the pattern), so a column is computed in a few word
+ * operations per 64 characters. Patterns longer than 64 code points are
+ * processed in blocks of 64, with the horizontal difference carried from
+ * block to block.
+ *
+ * Up to a fixed length no heap allocation is done, longer strings
+ * (which are not really expected as command line keywords) use heap
+ * allocated storage for the same algorithm.
+ */
+
+static constexpr size_t wordBits = 64;
+
+/// Number of blocks handled with static (per thread) storage.
+static constexpr size_t inlineBlocks = 4;
+
+/// Match masks for a pattern that consists of ASCII characters only.
+struct AsciiPeq
+{
+	using Char = unsigned char;
+	using Block = uint64_t[128];
+
+	Block* blocks;
+
+	/// Set up the masks, expects the storage to be all zeros.
+	inline void build(const Char* p, size_t m)
+	{
+		for(auto i = 0u; i < m; i++)
+		{
+			blocks[i / wordBits][p[i]] |= uint64_t(1) << (i % wordBits);
+		}
+	}
+
+	/// Restore the storage to all zeros, cheaper than clearing the whole table for every call.
+	inline void clear(const Char* p, size_t m)
+	{
+		for(auto i = 0u; i < m; i++)
+		{
+			blocks[i / wordBits][p[i]] = 0;
+		}
+	}
+
+	inline uint64_t get(size_t b, Char c) const {
+		return blocks[b][c];
+	}
+};
+
+/// Match masks for a pattern of arbitrary code points.
+struct WidePeq
+{
+	using Char = char32_t;
+
+	struct Block
+	{
+		size_t count;
+		char32_t codePoints[wordBits];
+		uint64_t masks[wordBits];
+	};
+
+	Block* blocks;
+
+	inline void build(const Char* p, size_t m)
+	{
+		for(auto b = 0u; b < (m + wordBits - 1) / wordBits; b++)
+		{
+			blocks[b].count = 0;
+		}
+
+		for(auto i = 0u; i < m; i++)
+		{
+			auto &block = blocks[i / wordBits];
+			const auto end = block.codePoints + block.count;
+			const auto idx = static_cast<size_t>(std::find(block.codePoints, end, p[i]) - block.codePoints);
+
+			if(idx == block.count)
+			{
+				block.codePoints[block.count] = p[i];
+				block.masks[block.count++] = 0;
+			}
+
+			block.masks[idx] |= uint64_t(1) << (i % wordBits);
+		}
+	}
+
+	inline void clear(const Char*, size_t) {}
+
+	inline uint64_t get(size_t b, Char c) const
+	{
+		const auto &block = blocks[b];
+
+		for(auto i = 0u; i < block.count; i++)
+		{
+			if(block.codePoints[i] == c)
+			{
+				return block.masks[i];
+			}
+		}
+
+		return 0;
+	}
+};
+
+/**
+ * Advance a block of vertical differences by one column.
+ *
+ * Takes the horizontal difference entering at the top of the block and
+ * returns the one leaving at the row selected by the high mask.
+ */
+static inline int advanceBlock(uint64_t &pv, uint64_t &mv, uint64_t eq, int hin, uint64_t high)
+{
+	const uint64_t hinNeg = hin < 0;
+	const uint64_t xv = eq | mv;
+	eq |= hinNeg;
+
+	const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+	uint64_t ph = mv | ~(xh | pv);
+	uint64_t mh = pv & xh;
+
+	const int hout = (ph & high) ? 1 : ((mh & high) ? -1 : 0);
+
+	ph = (ph << 1) | uint64_t(hin > 0);
+	mh = (mh << 1) | hinNeg;
+
+	pv = mh | ~(xv | ph);
+	mv = ph & xv;
+	return hout;
+}
+
+/**
+ * Compute the distance with a prepared pattern (of length m > 0) against
+ * a text, using the supplied storage for the vertical differences.
+ */
+template<class Peq>
+static inline size_t bitParallel(const Peq& peq, size_t m, const typename Peq::Char* t, size_t n, size_t maxDistance, uint64_t* pv, uint64_t* mv)
 {
-	std::unique_ptr<size_t[]> prev(new size_t[b.length() + 1]), next(new size_t[b.length() + 1]);
+	const auto nBlocks = (m + wordBits - 1) / wordBits;
+	const auto lastHigh = uint64_t(1) << ((m - 1) % wordBits);
+
+	std::fill(pv, pv + nBlocks, ~uint64_t(0));
+	std::fill(mv, mv + nBlocks, uint64_t(0));
+
+	size_t score = m;
 
-	for(auto j = 0u; j <= b.length(); j++)
+	if(nBlocks == 1)
 	{
-		prev[j] = j;
+		for(auto j = 0u; j < n; j++)
+		{
+			score += advanceBlock(pv[0], mv[0], peq.get(0, t[j]), 1, lastHigh);
+
+			if(const auto left = n - j - 1; score > left && score - left > maxDistance)
+			{
+				return maxDistance + 1;
+			}
+		}
+
+		return score;
 	}
 
-	for(auto i = 0u; i < a.length(); i++)
+	for(auto j = 0u; j < n; j++)
 	{
-		next[0] = i;
+		int carry = 1;
 
-		for(auto j = 0u; j < b.length(); j++)
+		for(auto b = 0u; b < nBlocks; b++)
 		{
-			next[j + 1] = (a[i] == b[j]) ? prev[j] : 1 + std::min({prev[j], prev[j + 1], next[j]});
+			const auto high = (b == nBlocks - 1) ? lastHigh : (uint64_t(1) << (wordBits - 1));
+			carry = advanceBlock(pv[b], mv[b], peq.get(b, t[j]), carry, high);
 		}
 
-		std::swap(prev, next);
+		score += carry;
+
+		// Every remaining column can decrease the distance by at most one.
+		if(const auto left = n - j - 1; score > left && score - left > maxDistance)
+		{
+			return maxDistance + 1;
+		}
+	}
+
+	return score;
+}
+
+template<class Peq>
+static inline size_t distance(const typename Peq::Char* a, size_t n, const typename Peq::Char* b, size_t m, size_t maxDistance)
+{
+	if(n < m)
+	{
+		std::swap(a, b);
+		std::swap(n, m);
+	}
+
+	if(n - m > maxDistance)
+	{
+		return maxDistance + 1;
+	}
+
+	if(m == 0)
+	{
+		return n;
+	}
+
+	const auto nBlocks = (m + wordBits - 1) / wordBits;
+
+	if(nBlocks <= inlineBlocks)
+	{
+		// Kept zeroed between calls (see AsciiPeq::clear).
+		static thread_local typename Peq::Block storage[inlineBlocks];
+		uint64_t pv[inlineBlocks], mv[inlineBlocks];
+
+		Peq peq{storage};
+		peq.build(b, m);
+		const auto ret = bitParallel(peq, m, a, n, maxDistance, pv, mv);
+		peq.clear(b, m);
+		return ret;
+	}
+
+	std::unique_ptr<typename Peq::Block[]> storage(new typename Peq::Block[nBlocks]());
+	std::unique_ptr<uint64_t[]> pv(new uint64_t[nBlocks]), mv(new uint64_t[nBlocks]);
+
+	Peq peq{storage.get()};
+	peq.build(b, m);
+	return bitParallel(peq, m, a, n, maxDistance, pv.get(), mv.get());
+}
+
+static inline bool isAscii(std::string_view s)
+{
+	size_t i = 0;
+
+	for(; i + sizeof(uint64_t) <= s.length(); i += sizeof(uint64_t))
+	{
+		uint64_t w;
+		std::memcpy(&w, s.data() + i, sizeof(w));
+
+		if(w & 0x8080808080808080u)
+		{
+			return false;
+		}
+	}
+
+	for(; i < s.length(); i++)
+	{
+		if(s[i] & 0x80)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Decode UTF-8 into code points, returns the number of code points.
+ *
+ * Bytes that are not part of a valid sequence are mapped to distinct
+ * values (in the low surrogate range that is never a valid code point),
+ * so they still compare equal to themselves only. The output must have
+ * room for as many elements as there are bytes in the input.
+ */
+static inline size_t decodeUtf8(std::string_view s, char32_t* out)
+{
+	size_t n = 0;
+
+	for(size_t i = 0; i < s.length();)
+	{
+		const auto c = static_cast<unsigned char>(s[i]);
+		const size_t len = (c < 0x80) ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 0;
+		char32_t cp = (len == 1) ? c : (len == 2) ? (c & 0x1f) : (len == 3) ? (c & 0x0f) : (c & 0x07);
+		bool valid = len != 0 && i + len <= s.length();
+
+		for(size_t k = 1; valid && k < len; k++)
+		{
+			const auto cc = static_cast<unsigned char>(s[i + k]);
+			valid = (cc >> 6) == 0x2;
+			cp = (cp << 6) | (cc & 0x3f);
+		}
+
+		if(valid)
+		{
+			out[n++] = cp;
+			i += len;
+		}
+		else
+		{
+			out[n++] = 0xdc00 + c;
+			i++;
+		}
+	}
+
+	return n;
+}
+
+size_t levenshteinDistance(std::string_view a, std::string_view b, size_t maxDistance)
+{
+	if(isAscii(a) && isAscii(b))
+	{
+		return distance<AsciiPeq>(reinterpret_cast<const unsigned char*>(a.data()), a.length(),
+				reinterpret_cast<const unsigned char*>(b.data()), b.length(), maxDistance);
+	}
+
+	static constexpr size_t inlineCodePoints = inlineBlocks * wordBits;
+
+	if(a.length() <= inlineCodePoints && b.length() <= inlineCodePoints)
+	{
+		char32_t da[inlineCodePoints], db[inlineCodePoints];
+		return distance<WidePeq>(da, decodeUtf8(a, da), db, decodeUtf8(b, db), maxDistance);
 	}
 
-	return prev[b.length()];
+	std::unique_ptr<char32_t[]> da(new char32_t[a.length()]), db(new char32_t[b.length()]);
+	return distance<WidePeq>(da.get(), decodeUtf8(a, da.get()), db.get(), decodeUtf8(b, db.get()), maxDistance);
 }
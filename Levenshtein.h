@@ -17,11 +17,20 @@
  *
  *******************************************************************************/
 
+
 #ifndef CLI_BASE_LEVENSHTEIN_H_
 #define CLI_BASE_LEVENSHTEIN_H_
 
+#include <cstdint>
 #include <string_view>
 
-size_t levenshteinDistance(std::string_view a, std::string_view b);
+/**
+ * Compute the edit distance of two UTF-8 strings, in code points.
+ *
+ * If the distance is greater than the specified maximum then the
+ * computation is abandoned as early as possible and some value
+ * greater than the maximum is returned.
+ */
+size_t levenshteinDistance(std::string_view a, std::string_view b, size_t maxDistance = SIZE_MAX);
 
 #endif /* CLI_BASE_LEVENSHTEIN_H_ */
@@ -0,0 +1,517 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+
+#include "CliApp.h"
+#include "Allocations.h"
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#include <unistd.h>
+#include <libgen.h>
+
+/**
+ * Hidden applet that exports a static completion manifest.
+ *
+ * The manifest contains the applet names, the keys of their options and
+ * the kinds of the arguments of the options, so that the completion of
+ * everything except arguments with dynamic candidates can be done by the
+ * shell without executing the program.
+ *
+ * Usage: _manifest bash [<tool name>]
+ *        _manifest binary
+ *
+ * The _bash_ format is a self-contained completion script (to be installed
+ * instead of the generic one), that embeds the manifest as bash arrays and
+ * calls back into the program only for dynamic candidates. The tool name
+ * defaults to the name of the executable.
+ *
+ * The _binary_ format is meant for other (non-shell) consumers, all integers
+ * are little endian, strings are stored as u32 length followed by the bytes:
+ *
+ *     "CLIBMF01"
+ *     u32 applet count, for each applet:
+ *         string name (subcommand paths are separated by spaces), u8 visible,
+ *         u32 option count, for each option:
+ *             u32 key count, string keys...
+ *             string description
+ *             u32 argument count, for each argument:
+ *                 u8 kind (0: words, 1: file, 2: directory, 3: dynamic, the
+ *                     high bit is set for the last argument of variadic options)
+ *                 string type name
+ *                 u32 word count, string words...
+ */
+struct ManifestExporter: CliApp
+{
+	static constexpr const char* appName = "_manifest";
+	static constexpr const char* appDesc = "Completion manifest exporter";
+
+	static inline CliApp& instance()
+	{
+		static ManifestExporter instance;
+		return instance;
+	}
+
+	virtual ~ManifestExporter() = default;
+
+	virtual int autocomplete(OptionParser::ArgIter from, OptionParser::ArgIter to, std::string_view word, const OptionParser::Sink& sink) override {
+		sink("bash");
+		sink("binary");
+		return 0;
+	}
+
+	virtual const OptionParser* collectOptions() override {
+		return nullptr;
+	}
+
+	/// Kind of completion for an argument of an option.
+	enum class ArgumentKind: uint8_t { Words = 0, File = 1, Directory = 2, Dynamic = 3 };
+
+	struct ArgumentInfo
+	{
+		ArgumentKind kind;
+		std::string type;
+		std::list<std::string> words;
+		bool repeated = false;
+	};
+
+	struct OptionInfo
+	{
+		std::vector<std::string> keys;
+		std::string description;
+		std::vector<ArgumentInfo> arguments;
+	};
+
+	struct AppletInfo
+	{
+		std::string name;
+		bool visible;
+		std::vector<OptionInfo> options;
+	};
+
+	static inline ArgumentInfo describeArgument(const OptionParser::Option& opt, size_t idx, const std::string &type)
+	{
+		if(opt.dynamicCandidates[idx])
+		{
+			return {ArgumentKind::Dynamic, type, {}};
+		}
+
+		const OptionParser::Arguments preceding(idx);
+		auto it = preceding.cbegin();
+
+		if(const auto s = opt.suggest(it, preceding.cend(), std::nullopt))
+		{
+			switch(s->first)
+			{
+				case 0: return {ArgumentKind::Words, type, s->second};
+				case 1: return {ArgumentKind::File, type, {}};
+				case 2: return {ArgumentKind::Directory, type, {}};
+			}
+		}
+
+		return {ArgumentKind::Dynamic, type, {}};
+	}
+
+	static inline std::vector<AppletInfo> collect()
+	{
+		std::vector<AppletInfo> ret;
+
+		const auto apps = ::CliApp::registry();
+		for(auto a = apps.first; a != apps.second; a++)
+		{
+			AppletInfo info{a->name, a->visible, {}};
+			const Allocations::Applet applet(a->name);
+
+			if(const auto parser = a->instance().collectOptions())
+			{
+				std::map<const OptionParser::Option*, size_t> indices;
+
+				for(const auto &o: parser->options)
+				{
+					auto it = indices.find(o.second);
+
+					if(it == indices.end())
+					{
+						it = indices.insert({o.second, info.options.size()}).first;
+
+						OptionInfo opt{{}, std::string(o.second->description), {}};
+
+						for(size_t idx = 0; idx < o.second->argumentCount; idx++)
+						{
+							opt.arguments.push_back(describeArgument(*o.second, idx, o.second->optionTypes[idx]));
+						}
+
+						if(o.second->variadic)
+						{
+							opt.arguments.back().repeated = true;
+						}
+
+						info.options.push_back(std::move(opt));
+					}
+
+					info.options[it->second].keys.emplace_back(o.first);
+				}
+			}
+
+			ret.push_back(std::move(info));
+		}
+
+		return ret;
+	}
+
+	/// Quote a string for bash using the $'...' syntax.
+	static inline std::string bashQuote(const std::string &s)
+	{
+		static constexpr const char hex[] = "0123456789abcdef";
+		std::string ret = "$'";
+
+		for(const char c: s)
+		{
+			switch(c)
+			{
+				case '\\': ret += "\\\\"; break;
+				case '\'': ret += "\\'"; break;
+				case '\n': ret += "\\n"; break;
+				case '\t': ret += "\\t"; break;
+				default:
+					if(static_cast<unsigned char>(c) < 0x20)
+					{
+						ret += "\\x";
+						ret += hex[c >> 4];
+						ret += hex[c & 0xf];
+					}
+					else
+					{
+						ret += c;
+					}
+			}
+		}
+
+		return ret + "'";
+	}
+
+	static inline void writeBash(const std::vector<AppletInfo>& apps, const std::string& tool, std::ostream& out)
+	{
+		std::string id = tool;
+		for(auto& c: id)
+		{
+			if(!isalnum(static_cast<unsigned char>(c)) && c != '_')
+			{
+				c = '_';
+			}
+		}
+
+		const auto prefix = "_cli_base_" + id;
+
+		out << "# Bash completion for " << tool << ", generated by '" << tool << " _manifest bash'." << std::endl << std::endl;
+
+		// The (visible) subcommands of every command path that has any, the empty path is the root.
+		std::map<std::string, std::set<std::string>> subs;
+		for(const auto& a: apps)
+		{
+			for(size_t start = 0, end; start <= a.name.length(); start = end + 1)
+			{
+				end = std::min(a.name.find(' ', start), a.name.length());
+				auto& words = subs[a.name.substr(0, start ? start - 1 : 0)];
+
+				if(a.visible)
+				{
+					words.insert(a.name.substr(start, end - start));
+				}
+			}
+		}
+
+		out << prefix << "_apps=(";
+		for(const auto& w: subs[""])
+		{
+			out << " " << bashQuote(w);
+		}
+		out << " )" << std::endl << std::endl;
+
+		out << "declare -A " << prefix << "_subs=(" << std::endl;
+		for(const auto& s: subs)
+		{
+			if(!s.first.empty())
+			{
+				std::string words;
+				for(const auto& w: s.second)
+				{
+					words += (words.empty() ? "" : "\n") + w;
+				}
+
+				out << "    [" << bashQuote(s.first) << "]=" << bashQuote(words) << std::endl;
+			}
+		}
+		out << ")" << std::endl << std::endl;
+
+		out << "declare -A " << prefix << "_opts=(" << std::endl;
+		for(const auto& a: apps)
+		{
+			std::string keys;
+			for(const auto& o: a.options)
+			{
+				for(const auto& k: o.keys)
+				{
+					keys += (keys.empty() ? "" : "\n") + k;
+				}
+			}
+
+			out << "    [" << bashQuote(a.name) << "]=" << bashQuote(keys) << std::endl;
+		}
+		out << ")" << std::endl << std::endl;
+
+		static constexpr const char kindCodes[] = {'w', 'f', 'd', 'x'};
+
+		out << "declare -A " << prefix << "_args=(" << std::endl;
+		for(const auto& a: apps)
+		{
+			for(auto i = 0u; i < a.options.size(); i++)
+			{
+				std::string spec = std::to_string(i);
+				for(const auto& arg: a.options[i].arguments)
+				{
+					spec += ' ';
+					spec += kindCodes[static_cast<uint8_t>(arg.kind)];
+
+					if(arg.repeated)
+					{
+						spec += '*';
+					}
+				}
+
+				for(const auto& k: a.options[i].keys)
+				{
+					out << "    [" << bashQuote(a.name + "\t" + k) << "]=" << bashQuote(spec) << std::endl;
+				}
+			}
+		}
+		out << ")" << std::endl << std::endl;
+
+		out << "declare -A " << prefix << "_words=(" << std::endl;
+		for(const auto& a: apps)
+		{
+			for(const auto& o: a.options)
+			{
+				for(auto i = 0u; i < o.arguments.size(); i++)
+				{
+					if(o.arguments[i].kind == ArgumentKind::Words)
+					{
+						std::string words;
+						for(const auto& w: o.arguments[i].words)
+						{
+							words += (words.empty() ? "" : "\n") + w;
+						}
+
+						for(const auto& k: o.keys)
+						{
+							out << "    [" << bashQuote(a.name + "\t" + k + "\t" + std::to_string(i)) << "]=" << bashQuote(words) << std::endl;
+						}
+					}
+				}
+			}
+		}
+		out << ")" << std::endl << std::endl;
+
+		out << prefix << R"sh(_dynamic()
+{
+    for i in ${!words[@]}; do
+        words[i]="$(printf '%s' "${words[i]}" | xargs printf '%s\n' 2>/dev/null || true)"
+    done
+
+    local c reply
+    mapfile -d '' reply < <(${COMP_WORDS[0]} _autocomplete -0 $COMP_CWORD "${words[@]}")
+
+    case ${reply[0]:--1} in
+        0) for c in "${reply[@]:1}"; do [[ $c == "$cur"* ]] && COMPREPLY+=( "$c" ); done;;
+        1) COMPREPLY=( $( compgen -f -- $cur ) );;
+        2) COMPREPLY=( $( compgen -d -- $cur ) );;
+        3) COMPREPLY=( "${reply[@]:1}" );;
+    esac
+}
+
+)sh" << prefix << R"sh(_completions()
+{
+    local cur prev words cword
+    _init_completion || return
+
+    local IFS=$'\n'
+
+    if (( cword == 1 )); then
+        COMPREPLY=( $( compgen -W "${)sh" << prefix << R"sh(_apps[*]}" -- "$cur" ) )
+        return 0
+    fi
+
+    # The words naming subcommands are followed as long as they exist.
+    local app=${words[1]} first=2
+    while (( first < cword )) && [[ -n ${)sh" << prefix << R"sh(_opts[$app ${words[first]}]+set}${)sh" << prefix << R"sh(_subs[$app ${words[first]}]+set} ]]; do
+        app+=" ${words[first]}"
+        (( first++ ))
+    done
+
+    local -a subs=()
+    (( first == cword )) && subs=( ${)sh" << prefix << R"sh(_subs[$app]-} )
+
+    if [[ -z ${)sh" << prefix << R"sh(_opts[$app]+set} ]]; then
+        [[ -n ${)sh" << prefix << R"sh(_subs[$app]+set} ]] && (( first == cword )) || return 1
+        COMPREPLY=( $( compgen -W "${subs[*]}" -- "$cur" ) )
+        return 0
+    fi
+
+    local -A used=()
+    local i spec
+    local -a fields
+
+    for (( i = first; i < cword; i++ )); do
+        spec=${)sh" << prefix << R"sh(_args[$app$'\t'${words[i]}]-}
+        [[ -n $spec ]] || continue
+
+        IFS=' ' read -r -a fields <<< "$spec"
+        used[${fields[0]}]=1
+
+        local n=$(( ${#fields[@]} - 1 ))
+        local end=$(( i + n ))
+
+        # The last argument of a variadic option (marked with *) takes the words up to the next option or --.
+        if [[ ${fields[n]} == *'*' ]]; then
+            while (( end < cword )) && [[ ${words[end + 1]} != -- && -z ${)sh" << prefix << R"sh(_args[$app$'\t'${words[end + 1]}]+set} ]]; do
+                (( end++ ))
+            done
+        fi
+
+        if (( end >= cword )); then
+            local idx=$(( cword - i < n ? cword - i : n ))
+
+            case ${fields[idx]%'*'} in
+                w) COMPREPLY=( $( compgen -W "${)sh" << prefix << R"sh(_words[$app$'\t'${words[i]}$'\t'$(( idx - 1 ))]}" -- "$cur" ) );;
+                f) COMPREPLY=( $( compgen -f -- "$cur" ) );;
+                d) COMPREPLY=( $( compgen -d -- "$cur" ) );;
+                *) )sh" << prefix << R"sh(_dynamic;;
+            esac
+
+            return 0
+        fi
+
+        (( i = end ))
+        [[ ${fields[n]} == *'*' && ${words[i + 1]-} == -- ]] && (( i++ ))
+    done
+
+    local key
+    local -a keys=()
+
+    for key in ${)sh" << prefix << R"sh(_opts[$app]}; do
+        spec=${)sh" << prefix << R"sh(_args[$app$'\t'$key]}
+        [[ -n ${used[${spec%% *}]-} ]] || keys+=( "$key" )
+    done
+
+    COMPREPLY=( $( compgen -W "${subs[*]}"$'\n'"${keys[*]}" -- "$cur" ) )
+    return 0
+}
+
+complete -o filenames -F )sh" << prefix << "_completions " << tool << std::endl;
+	}
+
+	static inline void writeBinary(const std::vector<AppletInfo>& apps, std::ostream& out)
+	{
+		const auto u8 = [&out](uint8_t v) { out.put(static_cast<char>(v)); };
+		const auto u32 = [&out](uint32_t v) {
+			const char bytes[] = {char(v), char(v >> 8), char(v >> 16), char(v >> 24)};
+			out.write(bytes, sizeof(bytes));
+		};
+		const auto str = [&out, &u32](const std::string &s) {
+			u32(s.length());
+			out.write(s.data(), s.length());
+		};
+
+		out.write("CLIBMF01", 8);
+		u32(apps.size());
+
+		for(const auto& a: apps)
+		{
+			str(a.name);
+			u8(a.visible);
+			u32(a.options.size());
+
+			for(const auto& o: a.options)
+			{
+				u32(o.keys.size());
+				for(const auto& k: o.keys)
+				{
+					str(k);
+				}
+
+				str(o.description);
+				u32(o.arguments.size());
+
+				for(const auto& arg: o.arguments)
+				{
+					u8(static_cast<uint8_t>(arg.kind) | (arg.repeated ? 0x80 : 0));
+					str(arg.type);
+					u32(arg.words.size());
+
+					for(const auto& w: arg.words)
+					{
+						str(w);
+					}
+				}
+			}
+		}
+
+		out.flush();
+	}
+
+	virtual int operator()(int argc, const char* argv[]) override
+	{
+		const std::string format = (argc > 0) ? argv[0] : "";
+
+		if(format == "bash")
+		{
+			std::string tool = (argc > 1) ? argv[1] : "";
+
+			if(tool.empty())
+			{
+				char exe[4096];
+
+				if(const auto n = readlink("/proc/self/exe", exe, sizeof(exe) - 1); n > 0)
+				{
+					exe[n] = '\0';
+					tool = basename(exe);
+				}
+			}
+
+			writeBash(collect(), tool, std::cout);
+			return 0;
+		}
+		else if(format == "binary")
+		{
+			writeBinary(collect(), std::cout);
+			return 0;
+		}
+
+		std::cerr << "Usage: _manifest bash [<tool name>] | _manifest binary" << std::endl;
+		return -1;
+	}
+};
+
+CLI_APP_REGISTER(ManifestExporter, false);
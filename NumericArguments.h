@@ -0,0 +1,354 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#ifndef CLI_BASE_NUMERICARGUMENTS_H_
+#define CLI_BASE_NUMERICARGUMENTS_H_
+
+#include "ArgumentReader.h"
+
+#include <chrono>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/**
+ * Size in bytes, with an optional unit suffix.
+ *
+ * The suffixes K, M, G, T, P and E (case insensitive) are binary multiples
+ * on their own or followed by i or iB (like 4K or 4KiB), and decimal ones
+ * if followed by B (4KB is 4000), B alone means bytes. The number may have
+ * a fractional part (like 1.5G).
+ */
+struct ByteSize
+{
+	uint64_t bytes = 0;
+
+	inline constexpr operator uint64_t() const {
+		return bytes;
+	}
+};
+
+template<> struct ArgumentParser<ByteSize>
+{
+	static constexpr const auto typeName = "size";
+
+	static inline Parsed<ByteSize> parseValue(std::string_view str)
+	{
+		const auto unitStart = str.find_first_not_of("0123456789.");
+		const auto number = str.substr(0, unitStart);
+		auto unit = (unitStart == std::string_view::npos) ? std::string_view{} : str.substr(unitStart);
+
+		uint64_t multiplier = 1;
+
+		if(!unit.empty() && unit != "B")
+		{
+			static constexpr const char prefixes[] = "KMGTPE";
+			const auto prefix = std::strchr(prefixes, unit[0] & ~0x20);
+
+			if(!prefix || !*prefix)
+			{
+				return ParseError{"invalid size unit: '" + std::string(str) + "'"};
+			}
+
+			unit.remove_prefix(1);
+
+			const auto base = (unit == "B") ? 1000 : 1024;
+			if(!unit.empty() && unit != "B" && unit != "i" && unit != "iB")
+			{
+				return ParseError{"invalid size unit: '" + std::string(str) + "'"};
+			}
+
+			for(auto i = prefixes; i <= prefix; i++)
+			{
+				multiplier *= base;
+			}
+		}
+
+		uint64_t ret;
+
+		if(number.find('.') == std::string_view::npos)
+		{
+			auto value = parseNumber<uint64_t>(number, typeName);
+
+			if(!value)
+			{
+				return value.error();
+			}
+
+			if(__builtin_mul_overflow(*value, multiplier, &ret))
+			{
+				return ParseError{"size value out of range: '" + std::string(str) + "'"};
+			}
+		}
+		else
+		{
+			auto value = parseNumber<double>(number, typeName);
+
+			if(!value)
+			{
+				return value.error();
+			}
+
+			if(!(*value * multiplier < 0x1p64))
+			{
+				return ParseError{"size value out of range: '" + std::string(str) + "'"};
+			}
+
+			ret = *value * multiplier;
+		}
+
+		return ByteSize{ret};
+	}
+
+	template<class It>
+	static inline Parsed<ByteSize> parse(It& it, const It& end)
+	{
+		if(it != end)
+		{
+			return parseValue(*it++);
+		}
+
+		return ParseError{"missing size argument"};
+	}
+
+	static inline std::pair<int, std::list<std::string>> suggest() {
+		return {0, {typeName}};
+	}
+};
+
+/**
+ * Time duration, as a sequence of numbers with units (like 250ms or 1h30m).
+ *
+ * The units are ns, us, ms, s, m (or min), h and d, a number without unit
+ * is in seconds. The value is rounded to the resolution of the duration type
+ * of the option.
+ */
+template<class Rep, class Period> struct ArgumentParser<std::chrono::duration<Rep, Period>>
+{
+	using Duration = std::chrono::duration<Rep, Period>;
+
+	static constexpr const auto typeName = "duration";
+
+	static inline Parsed<Duration> parseValue(std::string_view str)
+	{
+		static constexpr std::pair<std::string_view, double> units[] = {
+			{"ns", 1}, {"us", 1e3}, {"ms", 1e6}, {"s", 1e9}, {"m", 60e9}, {"min", 60e9}, {"h", 3600e9}, {"d", 86400e9}
+		};
+
+		std::chrono::duration<double, std::nano> ret{0};
+
+		if(str.empty())
+		{
+			return ParseError{"invalid duration value: ''"};
+		}
+
+		for(auto rest = str; !rest.empty();)
+		{
+			const auto numberEnd = std::min(rest.find_first_not_of("0123456789."), rest.size());
+			const auto unitEnd = std::min(rest.find_first_of("0123456789.", numberEnd), rest.size());
+			const auto unit = rest.substr(numberEnd, unitEnd - numberEnd);
+
+			if(!numberEnd || (unit.empty() && rest.size() != str.size()))
+			{
+				return ParseError{"invalid duration value: '" + std::string(str) + "'"};
+			}
+
+			const auto value = parseNumber<double>(rest.substr(0, numberEnd), typeName);
+
+			if(!value)
+			{
+				return value.error();
+			}
+
+			double scale = 1e9;
+
+			if(!unit.empty())
+			{
+				const auto it = std::find_if(std::begin(units), std::end(units), [unit](const auto& u) { return u.first == unit; });
+
+				if(it == std::end(units))
+				{
+					return ParseError{"invalid duration unit: '" + std::string(str) + "'"};
+				}
+
+				scale = it->second;
+			}
+
+			ret += std::chrono::duration<double, std::nano>(*value * scale);
+			rest.remove_prefix(unitEnd);
+		}
+
+		if constexpr(std::chrono::treat_as_floating_point<Rep>::value)
+		{
+			return std::chrono::duration_cast<Duration>(ret);
+		}
+		else
+		{
+			if(!(ret < std::chrono::duration<double, std::nano>(Duration::max())))
+			{
+				return ParseError{"duration value out of range: '" + std::string(str) + "'"};
+			}
+
+			return std::chrono::round<Duration>(ret);
+		}
+	}
+
+	template<class It>
+	static inline Parsed<Duration> parse(It& it, const It& end)
+	{
+		if(it != end)
+		{
+			return parseValue(*it++);
+		}
+
+		return ParseError{"missing duration argument"};
+	}
+
+	static inline std::pair<int, std::list<std::string>> suggest() {
+		return {0, {typeName}};
+	}
+};
+
+/**
+ * Parse the leading decimal digits of an eight byte block using SWAR
+ * arithmetic (all digits are processed at once, in a 64 bit register).
+ *
+ * The block must be readable, returns the number of digits (at most 8).
+ */
+inline size_t parseDigitsSwar(const char* p, uint64_t &ret)
+{
+	uint64_t chunk;
+	std::memcpy(&chunk, p, sizeof(chunk));
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	chunk = __builtin_bswap64(chunk);
+#endif
+
+	// The high bit of a byte is set if it is not a digit, carries and borrows only affect the bytes after the first one.
+	const auto digits = chunk - 0x3030303030303030;
+	const auto nonDigits = (digits | (chunk + 0x4646464646464646) | chunk) & 0x8080808080808080;
+	const size_t count = nonDigits ? __builtin_ctzll(nonDigits) / 8 : 8;
+
+	if(!count)
+	{
+		return 0;
+	}
+
+	// The first digit is the lowest byte, shift them up so that the missing ones are leading zeroes.
+	auto value = digits << (8 * (8 - count));
+	value = (value * 10) + (value >> 8);
+	ret = (((value & 0x000000ff000000ff) * (100 + (1000000ull << 32))) + (((value >> 16) & 0x000000ff000000ff) * (1 + (10000ull << 32)))) >> 32;
+	return count;
+}
+
+/**
+ * Comma separated list of numbers (like 1,2,3).
+ *
+ * Integers of at most 8 digits are parsed with a SWAR kernel, everything
+ * else (and any malformed element, for the diagnostic) with from_chars.
+ */
+template<class T> struct ArgumentParser<std::vector<T>>
+{
+	static_assert(std::is_arithmetic_v<T>, "only lists of numbers are supported");
+
+	static constexpr const auto typeName = SuffixedTypeName<T, ',', '.', '.', '.'>::value;
+
+	/// Try to parse an element with the SWAR kernel, moves the pointer to the end of the element on success.
+	static inline bool parseFast(const char*& p, const char* end, T& ret)
+	{
+		if constexpr(std::is_integral_v<T>)
+		{
+			const bool negative = std::is_signed_v<T> && p != end && *p == '-';
+			const auto digits = p + negative;
+
+			uint64_t value;
+			size_t count;
+
+			if(end - digits < 8 || !(count = parseDigitsSwar(digits, value)) || (digits + count != end && digits[count] != ','))
+			{
+				return false;
+			}
+
+			if(negative ? (value > uint64_t(-(std::numeric_limits<T>::min() + 1)) + 1) : (value > uint64_t(std::numeric_limits<T>::max())))
+			{
+				return false;
+			}
+
+			ret = negative ? T(-int64_t(value - 1) - 1) : T(value);
+			p = digits + count;
+			return true;
+		}
+
+		return false;
+	}
+
+	static inline Parsed<std::vector<T>> parseValue(std::string_view str)
+	{
+		std::vector<T> ret;
+		ret.reserve(std::count(str.begin(), str.end(), ',') + 1);
+
+		for(const char *p = str.data(), *end = str.data() + str.size(); p != end;)
+		{
+			T value;
+
+			if(!parseFast(p, end, value))
+			{
+				const auto comma = static_cast<const char*>(std::memchr(p, ',', end - p));
+				const auto elementEnd = comma ? comma : end;
+				const auto element = parseNumber<T>(std::string_view(p, elementEnd - p), ArgumentParser<T>::typeName);
+
+				if(!element)
+				{
+					return element.error();
+				}
+
+				value = *element;
+				p = elementEnd;
+			}
+
+			ret.push_back(value);
+
+			if(p != end && ++p == end)
+			{
+				return ParseError{"invalid list value: '" + std::string(str) + "'"};
+			}
+		}
+
+		return ret;
+	}
+
+	template<class It>
+	static inline Parsed<std::vector<T>> parse(It& it, const It& end)
+	{
+		if(it != end)
+		{
+			return parseValue(*it++);
+		}
+
+		return ParseError{"missing list argument"};
+	}
+
+	static inline std::pair<int, std::list<std::string>> suggest() {
+		return {0, {typeName}};
+	}
+};
+
+#endif /* CLI_BASE_NUMERICARGUMENTS_H_ */
@@ -18,130 +18,532 @@
  *******************************************************************************/
 
 #include "OptionParser.h"
-#include "Levenshtein.h"
+#include "Trace.h"
 
+#include <map>
 #include <iostream>
-#include <numeric>
 #include <algorithm>
 
-struct SimplyExit {};
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 
 OptionParser::OptionParser(const std::string &header): header(header)
 {
 	addOptions({"-h", "--help"}, "Displays information about available options", [this]()
 	{
-		std::multimap<std::shared_ptr<Option>, std::string> reverse;
-		std::transform(options.begin(), options.end(), std::inserter(reverse, reverse.end()), [](const auto &p){ return std::make_pair(p.second, p.first);});
-		std::map<std::shared_ptr<Option>, std::vector<std::string>> grouped;
+		Trace::Span span("help");
+
+		const auto& page = helpPage();
+		errorStream->write(page.data(), page.size());
+		exitRequested = true;
+	});
+}
 
-		while(!reverse.empty())
+OptionParser::~OptionParser()
+{
+	for(const auto opt: records)
+	{
+		if(opt->destroy)
 		{
-			auto range = reverse.equal_range(reverse.begin()->first);
-			std::vector<std::string> names;
-			std::transform(range.first, range.second, std::back_inserter(names), [](const auto &p){ return p.second;});
-			std::sort(names.begin(), names.end(), [](const auto& a, const auto& b)
-			{
-				if(a.length() < b.length())
-					return true;
-				else if(a.length() == b.length())
-					return a < b;
-				else
-					return false;
-			});
-			grouped.insert({range.first->first, names});
-			reverse.erase(range.first, range.second);
+			opt->destroy(opt->callback);
 		}
+	}
+}
 
-		std::map<std::string, std::pair<std::string, std::string>> flattened;
-		std::transform(grouped.begin(), grouped.end(), std::inserter(flattened, flattened.end()), [](const auto &p)
+void* OptionParser::Arena::allocate(size_t size, size_t alignment)
+{
+	const auto padding = (alignment - reinterpret_cast<uintptr_t>(next) % alignment) % alignment;
+
+	if(!next || padding + size > left)
+	{
+		// Large objects get a block of their own, the current one is kept for the small ones.
+		if(size > blockSize / 4)
 		{
-			auto flat = std::accumulate(p.second.begin(), p.second.end(), std::string("   "), [](const auto& a, const auto& b){
-				return a + " " + b;
-			});
+			blocks.emplace_back(new std::max_align_t[(size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t)]);
+			return blocks.back().get();
+		}
 
-			std::list<std::string> bracketed;
-			std::transform(p.first->optionTypes.begin(), p.first->optionTypes.end(), std::back_inserter(bracketed), [](const auto &a) {
-				return "<" + a + ">";
-			});
+		blocks.emplace_back(new std::max_align_t[blockSize / sizeof(std::max_align_t)]);
+		next = reinterpret_cast<char*>(blocks.back().get());
+		left = blockSize;
 
-			auto options = std::accumulate(bracketed.begin(), bracketed.end(), std::string{}, [](const auto& a, const auto& b){
-				return a + " " + b;
-			});
+		return allocate(size, alignment);
+	}
+
+	const auto ret = next + padding;
+	next = ret + size;
+	left -= padding + size;
+	return ret;
+}
+
+std::string_view OptionParser::Arena::copy(std::string_view str)
+{
+	const auto ret = static_cast<char*>(allocate(str.length(), 1));
+	std::memcpy(ret, str.data(), str.length());
+	return std::string_view(ret, str.length());
+}
 
-			return std::make_pair(flat, std::make_pair(options, p.first->description));
+/// Width of the terminal on the standard error, zero if it is not a terminal.
+static size_t terminalWidth()
+{
+	struct winsize ws;
+
+	if(ioctl(STDERR_FILENO, TIOCGWINSZ, &ws) == 0)
+	{
+		return ws.ws_col;
+	}
+
+	return 0;
+}
+
+const std::string& OptionParser::helpPage()
+{
+	if(help)
+	{
+		return *help;
+	}
+
+	std::map<const Option*, std::vector<std::string_view>> grouped;
+	for(const auto &o: options)
+	{
+		grouped[o.second].push_back(o.first);
+	}
+
+	struct Line
+	{
+		std::string names, types;
+		std::string_view description;
+	};
+
+	std::vector<Line> lines;
+	lines.reserve(grouped.size());
+	size_t maxNameLength = 0, maxTypesLength = 0;
+
+	for(auto &g: grouped)
+	{
+		std::sort(g.second.begin(), g.second.end(), [](const auto& a, const auto& b) {
+			return a.length() < b.length() || (a.length() == b.length() && a < b);
 		});
 
-		auto longestNameIt = std::max_element(flattened.begin(), flattened.end(), [](const auto &a, const auto &b){ return a.first.length() < b.first.length(); });
-		auto maxNameLength = longestNameIt->first.length();
+		Line line{"   ", {}, g.first->description};
+
+		for(const auto &n: g.second)
+		{
+			line.names.append(" ").append(n);
+		}
+
+		for(auto i = 0u; i < g.first->argumentCount; i++)
+		{
+			line.types.append(" <").append(g.first->optionTypes[i]).append(">");
+		}
+
+		maxNameLength = std::max(maxNameLength, line.names.length());
+		maxTypesLength = std::max(maxTypesLength, line.types.length());
+		lines.push_back(std::move(line));
+	}
+
+	std::sort(lines.begin(), lines.end(), [](const auto& a, const auto& b) { return a.names < b.names; });
+
+	// Descriptions are wrapped to the width of the terminal if there is reasonable room left for them.
+	static constexpr size_t minDescriptionWidth = 20;
+	const auto indent = maxNameLength + maxTypesLength + 2;
+	const auto width = terminalWidth();
+	const auto descriptionWidth = (width > indent + minDescriptionWidth) ? width - indent : 0;
+
+	std::string ret = header + "\n\nOptions: \n";
+
+	for(const auto &l: lines)
+	{
+		ret.append(l.names).append(maxNameLength - l.names.length() + 1, ' ');
+		ret.append(l.types).append(maxTypesLength - l.types.length() + 1, ' ');
+
+		std::string_view desc(l.description);
 
-		auto longestOptionsIt = std::max_element(flattened.begin(), flattened.end(), [](const auto &a, const auto &b){ return a.second.first.length() < b.second.first.length(); });
-		auto maxOptionsLength = longestOptionsIt->second.first.length();
+		while(descriptionWidth && desc.length() > descriptionWidth)
+		{
+			auto cut = desc.rfind(' ', descriptionWidth);
+			if(cut == std::string_view::npos || cut == 0)
+			{
+				cut = descriptionWidth;
+			}
+
+			ret.append(desc.substr(0, cut)).append("\n").append(indent, ' ');
+			desc.remove_prefix(cut + (desc[cut] == ' ' ? 1 : 0));
+		}
+
+		ret.append(desc).append("\n");
+	}
 
-		std::cerr << this->header << std::endl << std::endl;
-		std::cerr << "Options: "<< std::endl;
+	ret.append("\n");
 
-		for(auto& o: flattened)
+	help = std::move(ret);
+	return *help;
+}
+
+OptionParser::Option* OptionParser::findOption(std::string_view key)
+{
+	if(indexStale)
+	{
+		indexed = index.build(options);
+		indexStale = false;
+	}
+
+	if(!indexed)
+	{
+		const auto it = std::find_if(options.begin(), options.end(), [key](const auto& o) { return o.first == key; });
+		return (it != options.end()) ? it->second : nullptr;
+	}
+
+	if(auto ret = index.find(key))
+	{
+		return *ret;
+	}
+
+	return nullptr;
+}
+
+/// Whether an argument refers to a response file.
+static inline bool isResponseFile(std::string_view arg) {
+	return arg.length() > 1 && arg[0] == '@';
+}
+
+OptionParser::ResponseFiles::~ResponseFiles()
+{
+	for(const auto& m: mappings)
+	{
+		munmap(m.first, m.second);
+	}
+}
+
+const char* OptionParser::ResponseFiles::readUnmappable(int fd, size_t &size)
+{
+	std::string contents;
+	char buffer[4096];
+
+	while(true)
+	{
+		const auto n = ::read(fd, buffer, sizeof(buffer));
+
+		if(n < 0)
 		{
-			const auto names = o.first;
-			const auto options = o.second.first;
+			if(errno == EINTR)
+			{
+				continue;
+			}
 
-			std::cerr << names << std::string(maxNameLength - names.length() + 1, ' ')
-					<< options << std::string(maxOptionsLength - options.length() + 1, ' ') << o.second.second << std::endl;
+			return nullptr;
 		}
 
-		std::cerr << std::endl;
+		if(n == 0)
+		{
+			break;
+		}
 
-		throw SimplyExit{};
-	});
+		contents.append(buffer, n);
+	}
+
+	const auto &ret = buffers.emplace_back(std::move(contents));
+	size = ret.size();
+	return ret.data();
 }
 
-std::optional<std::list<std::string>> OptionParser::processArgs(const std::list<std::string>& args)
+/**
+ * The file is NUL delimited if it contains a NUL character, otherwise it
+ * is newline delimited (empty lines are skipped). Regular files are mapped
+ * into memory, other ones (like the pipe of a process substitution) are
+ * read into a buffer, the tokens are views of these.
+ *
+ * If there is no such file the argument is to be used literally, but if
+ * it exists and can not be read (like a directory) that is an error.
+ */
+OptionParser::ResponseFiles::Result OptionParser::ResponseFiles::read(std::string_view arg, Arguments& out)
 {
-	std::list<std::string> ret;
+	const std::string path(arg.substr(1));
+	const int fd = open(path.c_str(), O_RDONLY);
+
+	if(fd < 0)
+	{
+		struct stat st;
+		return (errno == ENOENT || errno == ENOTDIR || stat(path.c_str(), &st) != 0) ? Result::Literal : Result::Failed;
+	}
+
+	struct stat st;
+	const char* data = nullptr;
+	size_t size = 0;
+
+	if(fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return Result::Failed;
+	}
+
+	if(S_ISREG(st.st_mode))
+	{
+		size = st.st_size;
+
+		if(!size)
+		{
+			close(fd);
+			return Result::Read;
+		}
+
+		if(const auto m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0); m != MAP_FAILED)
+		{
+			madvise(m, size, MADV_SEQUENTIAL);
+			mappings.emplace_back(m, size);
+			data = static_cast<const char*>(m);
+		}
+	}
+
+	if(!data)
+	{
+		data = readUnmappable(fd, size);
+	}
+
+	close(fd);
+
+	if(!data)
+	{
+		return Result::Failed;
+	}
+
+	const auto end = data + size;
+	const bool nulDelimited = std::memchr(data, '\0', size) != nullptr;
+	const char delimiter = nulDelimited ? '\0' : '\n';
+
+	for(auto p = data; p < end;)
+	{
+		auto next = static_cast<const char*>(std::memchr(p, delimiter, end - p));
+		if(!next)
+		{
+			next = end;
+		}
+
+		std::string_view token(p, next - p);
+
+		if(!nulDelimited && !token.empty() && token.back() == '\r')
+		{
+			token.remove_suffix(1);
+		}
+
+		if(nulDelimited || !token.empty())
+		{
+			out.push_back(token);
+		}
+
+		p = next + 1;
+	}
+
+	return Result::Read;
+}
+
+bool OptionParser::expandResponseFiles(const Arguments& args, Arguments& out, size_t depth)
+{
+	for(const auto& arg: args)
+	{
+		if(isResponseFile(arg))
+		{
+			if(!depth)
+			{
+				*errorStream << "Response files nested too deep at '" << arg << "'" << std::endl;
+				return false;
+			}
+
+			Arguments contents;
+
+			switch(responseFiles.read(arg, contents))
+			{
+				case ResponseFiles::Result::Read:
+					if(!expandResponseFiles(contents, out, depth - 1))
+					{
+						return false;
+					}
+
+					continue;
+
+				case ResponseFiles::Result::Failed:
+					*errorStream << "Could not read response file '" << arg.substr(1) << "': " << std::strerror(errno) << std::endl;
+					return false;
+
+				case ResponseFiles::Result::Literal:
+					break;
+			}
+		}
+
+		out.push_back(arg);
+	}
+
+	return true;
+}
+
+OptionParser::ArgIter OptionParser::variadicEnd(ArgIter it, ArgIter end)
+{
+	while(it != end && *it != "--" && !findOption(*it))
+	{
+		it++;
+	}
+
+	return it;
+}
+
+std::optional<OptionParser::Arguments> OptionParser::processArgs(const Arguments& args)
+{
+	Arguments ret;
+
+	if(processArgs(args, [&ret](std::string_view arg) { ret.push_back(arg); }))
+	{
+		return ret;
+	}
+
+	return std::nullopt;
+}
+
+/**
+ * Invoke an option, the exceptions thrown by the user callback (if they are
+ * enabled) are reported the same way as the arguments that can not be read.
+ */
+static inline std::optional<ParseError> invokeOption(const OptionParser::Option& opt, OptionParser::ArgIter& it, OptionParser::ArgIter end)
+{
+#if __cpp_exceptions
+	try
+	{
+		return opt.parse(it, end);
+	}
+	catch(const std::exception &e)
+	{
+		return ParseError{e.what()};
+	}
+#else
+	return opt.parse(it, end);
+#endif
+}
+
+bool OptionParser::processArgs(const Arguments& rawArgs, const Sink& sink)
+{
+	Trace::Span span("processArgs");
+
+	exitRequested = false;
+
+	Arguments expanded;
+	const bool hasResponseFiles = std::any_of(rawArgs.begin(), rawArgs.end(), isResponseFile);
+
+	if(hasResponseFiles && !expandResponseFiles(rawArgs, expanded, maxResponseFileDepth))
+	{
+		return false;
+	}
+
+	const auto& args = hasResponseFiles ? expanded : rawArgs;
 
 	for(auto it = args.cbegin(); it != args.cend();)
 	{
 		const auto name = *it++;
 
-		if(const auto opt = options.find(name); opt == options.end())
+		if(const auto opt = findOption(name); !opt)
 		{
 			if(name.length() > 1 && name[0] == '-')
 			{
-				std::cerr << "Unknown option: '" << name << "' use -h or --help flag to display usage information" << std::endl;
+				*errorStream << "Unknown option: '" << name << "' use -h or --help flag to display usage information" << std::endl;
 
-				std::list<std::pair<size_t, std::string>> lDists;
+				Trace::Span span("suggestions", name);
 
-				std::transform(options.begin(), options.end(), std::back_inserter(lDists), [name](const auto& l) {
-					return std::make_pair(levenshteinDistance(name, l.first), l.first);
-				});
+				if(!suggestions)
+				{
+					suggestions.emplace();
 
-				const auto suggested = std::min_element(lDists.begin(), lDists.end(), [](const auto& a, const auto& b){return a.first < b.first;});
-				std::cerr << std::endl << "Did you mean: " << suggested->second << "?" << std::endl;
+					for(const auto& o: options)
+					{
+						suggestions->add(o.first);
+					}
+				}
 
-				return std::nullopt;
+				printSuggestions(*errorStream, suggestions->query(name));
+
+				return false;
 			}
 			else
 			{
-				ret.push_back(name);
+				sink(name);
 			}
 		}
 		else
 		{
-			try
+			Trace::Span span("option", name);
+
+			if(const auto error = invokeOption(*opt, it, opt->variadic ? variadicEnd(it, args.cend()) : args.cend()))
 			{
-				opt->second->parse(it, args.cend());
+				*errorStream << "Could not process option " << name  << ": " << error->message << std::endl;
+				return false;
 			}
-			catch(const std::exception &e)
+
+			if(exitRequested)
 			{
-				std::cerr << "Could not process option " << name  << ": " << e.what() << std::endl;
-				return std::nullopt;
+				return false;
 			}
-			catch(const SimplyExit&)
+
+			if(opt->variadic && it != args.cend() && *it == "--")
 			{
-				return std::nullopt;
+				it++;
 			}
 		}
 	}
 
-	return ret;
+	return true;
+}
+
+bool OptionParser::readItems(int fd, const Sink& sink, std::ostream& err)
+{
+	static constexpr size_t chunkSize = 64 * 1024;
+
+	std::vector<char> buffer(chunkSize);
+	size_t used = 0;
+
+	while(true)
+	{
+		if(used == buffer.size())
+		{
+			buffer.resize(buffer.size() * 2);
+		}
+
+		const auto n = read(fd, buffer.data() + used, buffer.size() - used);
+
+		if(n < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			err << "Could not read input: " << std::strerror(errno) << std::endl;
+			return false;
+		}
+
+		if(n == 0)
+		{
+			if(used)
+			{
+				sink(std::string_view(buffer.data(), used));
+			}
+
+			return true;
+		}
+
+		const auto end = buffer.data() + used + n;
+		auto p = buffer.data();
+
+		while(const auto next = static_cast<const char*>(std::memchr(p, '\0', end - p)))
+		{
+			sink(std::string_view(p, next - p));
+			p = const_cast<char*>(next) + 1;
+		}
+
+		used = end - p;
+		std::memmove(buffer.data(), p, used);
+	}
 }
@@ -20,45 +20,77 @@
 #ifndef CLI_BASE_OPTIONPARSER_H_
 #define CLI_BASE_OPTIONPARSER_H_
 
-#include <map>
 #include <list>
+#include <vector>
+#include <new>
 #include <memory>
 #include <optional>
 #include <functional>
 #include <string>
+#include <iostream>
+#include <string_view>
+#include <algorithm>
+#include <type_traits>
 #include <initializer_list>
 
 #include <cassert>
+#include <cstddef>
 
 #include "ArgumentReader.h"
+#include "PerfectHash.h"
+#include "SuggestionIndex.h"
+#include "Trace.h"
 
 /**
  * Option parsing and usage information generator utility for CLI.
  */
 struct OptionParser
 {
-	using cListIter = std::list<std::string>::const_iterator;
+	/**
+	 * Command line arguments.
+	 *
+	 * The elements are views of the argument vector of the process, which
+	 * is never modified and lives as long as the process itself, so the
+	 * values need not be copied during parsing.
+	 */
+	using Arguments = std::vector<std::string_view>;
+
+	/// Iterator over command line arguments.
+	using ArgIter = Arguments::const_iterator;
 
 	/**
 	 * A command line option.
+	 *
+	 * The record, its description and the user callback are stored in the
+	 * arena of the parser, the per-type information is in static tables,
+	 * and the callbacks are invoked through plain function pointers, so an
+	 * option does not need separate allocations.
 	 */
 	struct Option
 	{
 		/// The description of the option to be displayed to the user in usage info.
-		const std::string description;
+		std::string_view description;
 
-		/// The data types of the arguments expected by the option.
-		const std::list<std::string> optionTypes;
+		/// The names of the data types of the arguments expected by the option.
+		const char* const* optionTypes;
 
-		/**
-		 * Argument parser callback.
-		 *
-		 * Reads arguments and calls registered user method, invoked when the option
-		 * key is matched. First argument is a reference to an iterator pointing to
-		 * the first argument, which is incremented when a value is used. The second
-		 * one is the end of the input sequence.
-		 */
-		const std::function<void(cListIter&, cListIter)> parse;
+		/// Whether the candidates for each argument depend on the state of the system (see HasDynamicCandidates).
+		const bool* dynamicCandidates;
+
+		/// The number of arguments expected by the option.
+		size_t argumentCount;
+
+		/// Whether the last argument takes all values up to the next option (see Variadic).
+		bool variadic;
+
+		/// The user callback.
+		void* callback;
+
+		/// Invokes the user callback with the arguments read (see parse).
+		std::optional<ParseError> (*invoke)(const void* callback, ArgIter&, ArgIter);
+
+		/// Destroys the user callback, null if it is trivially destructible.
+		void (*destroy)(void* callback);
 
 		/**
 		 * Argument suggestion callback.
@@ -69,21 +101,132 @@ struct OptionParser
 		 * If all arguments are present returns an empty list. The first argument is
 		 * a reference to an iterator pointing to the first argument, which is moved
 		 * forward as values are used up. The second one is the end of the input sequence.
+		 * The third one is the word being completed, if it is set the candidates are
+		 * generated in process by the argument types that support it (see
+		 * HasInProcessCompletion), otherwise only the kind of the candidates is needed.
 		 */
-		const std::function<std::optional<std::pair<int, std::list<std::string>>>(cListIter&, cListIter)> suggest;
+		std::optional<std::pair<int, std::list<std::string>>> (*suggest)(ArgIter&, ArgIter, std::optional<std::string_view>);
 
-		/// Forwarding constructor
-		Option(const decltype(description) &description, decltype(optionTypes) &&optionTypes, decltype(parse) &&parse, decltype(suggest) &&suggest):
-			description(description), optionTypes(optionTypes), parse(parse), suggest(suggest) {}
+		/**
+		 * Argument parser callback.
+		 *
+		 * Reads arguments and calls registered user method, invoked when the option
+		 * key is matched. First argument is a reference to an iterator pointing to
+		 * the first argument, which is incremented when a value is used. The second
+		 * one is the end of the input sequence (or of the values for variadic options).
+		 * If an argument can not be read the user method is not called, and the
+		 * diagnostic is returned.
+		 */
+		inline std::optional<ParseError> parse(ArgIter& it, ArgIter end) const {
+			return invoke(callback, it, end);
+		}
+	};
+
+	/**
+	 * Bump allocator for the option records, keys, descriptions and callbacks.
+	 *
+	 * The memory is allocated in blocks that are only released with the
+	 * parser, so registering the options of an applet takes a few
+	 * allocations instead of several per option.
+	 */
+	class Arena
+	{
+		static constexpr size_t blockSize = 4096;
+
+		std::vector<std::unique_ptr<std::max_align_t[]>> blocks;
+		char* next = nullptr;
+		size_t left = 0;
+
+	public:
+		/// Allocate uninitialized memory.
+		void* allocate(size_t size, size_t alignment);
+
+		/// Copy a string into the arena.
+		std::string_view copy(std::string_view str);
 	};
 
+	/// Storage of the options.
+	Arena arena;
+
+	/// The options in the order of registration.
+	std::vector<Option*> records;
+
 	/**
-	 * The collection option keys registered for parsing.
+	 * The option keys registered for parsing, in the order of registration.
 	 *
 	 * Multiple entries may correspond to the same option if multiple
 	 * keys are added (e.g. long and short names, like -h and --help).
 	 */
-	std::map<std::string, std::shared_ptr<Option>> options;
+	std::vector<std::pair<std::string_view, Option*>> options;
+
+	/**
+	 * Perfect hash index of the option keys, used for matching arguments.
+	 *
+	 * The key set is frozen into the table at the first lookup after the
+	 * registration of options, it is rebuilt only if options are added
+	 * afterwards.
+	 */
+	PerfectHashTable<Option*> index;
+
+	/// Set when the index needs to be rebuilt before the next lookup.
+	bool indexStale = true;
+
+	/// Whether the index could be built, the keys are searched linearly if not.
+	bool indexed = false;
+
+	/// Index of the option keys for suggesting alternatives to unknown ones, built when first needed.
+	std::optional<SuggestionIndex> suggestions;
+
+	/// The usage information page, rendered when first needed (for the width of the terminal at that time).
+	std::optional<std::string> help;
+
+	/// Stream for the diagnostics and the usage page.
+	std::ostream* errorStream = &std::cerr;
+
+	/// Set by the help option, makes the processing stop without an error message.
+	bool exitRequested = false;
+
+	/**
+	 * The contents of the response files expanded by the parser.
+	 *
+	 * The arguments read from them are views of the contents, which are
+	 * kept (mapped, or in a buffer if the file can not be mapped) until
+	 * the parser is destroyed.
+	 */
+	class ResponseFiles
+	{
+		std::vector<std::pair<void*, size_t>> mappings;
+		std::list<std::string> buffers;
+
+		/// Read a file that can not be mapped into a new buffer, returns null on error.
+		const char* readUnmappable(int fd, size_t &size);
+
+	public:
+		/// The outcome of reading a response file.
+		enum class Result
+		{
+			Read,		///< The contents were split into arguments.
+			Literal,	///< There is no such file, the argument is to be used as is.
+			Failed		///< The file exists but could not be read.
+		};
+
+		/// Read the response file referred to by an argument and split it into arguments.
+		Result read(std::string_view arg, Arguments& out);
+
+		ResponseFiles() = default;
+		~ResponseFiles();
+		ResponseFiles(const ResponseFiles&) = delete;
+		ResponseFiles& operator=(const ResponseFiles&) = delete;
+	};
+
+	ResponseFiles responseFiles;
+
+	/**
+	 * Replace the response file references with their contents, recursively
+	 * up to the specified depth. Returns false if the limit is exceeded or a
+	 * response file could not be read.
+	 */
+	bool expandResponseFiles(const Arguments& args, Arguments& out, size_t depth);
 
 	/**
 	 * The header string to be printed at the beginning of
@@ -101,25 +244,81 @@ struct OptionParser
 	};
 
 	/**
-	 * Helper used to invoke the correct argument readers.
+	 * Helper used to invoke the correct argument readers, the method is
+	 * only called if all of them succeed, otherwise the first error is
+	 * returned.
 	 */
 	template<class Obj, class... Args>
-	static inline void parseOptions(void (Obj::* method)(Args...) const, const Obj& obj, cListIter& it, cListIter end)
+	static inline std::optional<ParseError> parseOptions(void (Obj::* method)(Args...) const, const Obj& obj, ArgIter& it, ArgIter end)
 	{
+		std::optional<ParseError> ret;
+
 		CallArgumentEvaluationSequencingHelper{
-			[&obj, &method](auto&&... x){ (obj.*method)(std::forward<decltype(x)>(x)...); },
-			ArgumentParser<std::remove_const_t<std::remove_reference_t<Args>>>::parse(it, end)...
+			[&obj, &method, &ret](auto&&... x)
+			{
+				if(((x || (ret = x.error(), false)) && ...))
+				{
+					(obj.*method)(std::move(*x)...);
+				}
+			},
+			readArgument<std::remove_const_t<std::remove_reference_t<Args>>>(it, end)...
 		};
+
+		return ret;
+	}
+
+	/// Whether a suggested candidate is the name of the argument type (standing for any value), instead of a value.
+	template<class T>
+	static inline bool isPlaceholder(const std::string& candidate)
+	{
+		if constexpr(IsVariadic<T>::value)
+		{
+			return isPlaceholder<typename T::value_type>(candidate);
+		}
+		else
+		{
+			return candidate == ArgumentParser<T>::typeName;
+		}
 	}
 
 	template<class T>
-	static inline std::optional<std::pair<int, std::list<std::string>>> suggestHelper(cListIter& it, cListIter end)
+	static inline std::pair<int, std::list<std::string>> candidates(std::optional<std::string_view> word)
 	{
+		if constexpr(HasInProcessCompletion<T>::value)
+		{
+			if(word)
+			{
+				return ArgumentParser<T>::complete(*word);
+			}
+		}
+
+		auto ret = ArgumentParser<T>::suggest();
+
+		// The placeholders are only offered for the words they start with, so they are not ranked as fuzzy matches (and inserted by the shell).
+		if(word)
+		{
+			ret.second.remove_if([word](const std::string& c) { return isPlaceholder<T>(c) && c.compare(0, word->length(), *word) != 0; });
+		}
+
+		return ret;
+	}
+
+	template<class T>
+	static inline std::optional<std::pair<int, std::list<std::string>>> suggestHelper(ArgIter& it, ArgIter end, std::optional<std::string_view> word)
+	{
+		if constexpr(IsVariadic<T>::value)
+		{
+			// The values of a variadic option end at the word to be completed.
+			it = end;
+			return candidates<T>(word);
+		}
+
 		if(it == end)
 		{
-			return ArgumentParser<T>::suggest();
+			return candidates<T>(word);
 		}
 
+		it++;
 		return std::nullopt;
 	}
 
@@ -127,7 +326,7 @@ struct OptionParser
 	 * Helper used to invoke the correct argument value candidate generators.
 	 */
 	template<class Obj, class... Args>
-	static inline std::optional<std::pair<int, std::list<std::string>>> generateArgumentCandidates(void (Obj::* method)(Args...) const, cListIter& it, cListIter end)
+	static inline std::optional<std::pair<int, std::list<std::string>>> generateArgumentCandidates(void (Obj::* method)(Args...) const, ArgIter& it, ArgIter end, std::optional<std::string_view> word)
 	{
 		std::optional<std::pair<int, std::list<std::string>>> ret;
 
@@ -145,7 +344,7 @@ struct OptionParser
 					}
 				}
 			},
-			suggestHelper<std::remove_const_t<std::remove_reference_t<Args>>>(it, end)...
+			suggestHelper<std::remove_const_t<std::remove_reference_t<Args>>>(it, end, word)...
 		};
 
 		return ret;
@@ -155,9 +354,40 @@ struct OptionParser
 	 * Generates the names of argument types for an option.
 	 */
 	template<class Obj, class... Args>
-	static inline auto optionTypes(void (Obj::* method)(Args...) const)
+	static inline const char* const* optionTypes(void (Obj::* method)(Args...) const)
 	{
-		return std::list<std::string>{ArgumentParser<std::remove_const_t<std::remove_reference_t<Args>>>::typeName...};
+		static constexpr const char* ret[] = {ArgumentParser<std::remove_const_t<std::remove_reference_t<Args>>>::typeName..., nullptr};
+		return ret;
+	}
+
+	/**
+	 * Generates the dynamic candidate flags of the arguments of an option.
+	 */
+	template<class Obj, class... Args>
+	static inline const bool* dynamicCandidates(void (Obj::* method)(Args...) const)
+	{
+		static constexpr bool ret[] = {HasDynamicCandidates<std::remove_const_t<std::remove_reference_t<Args>>>::value..., false};
+		return ret;
+	}
+
+	/**
+	 * Counts the arguments of an option.
+	 */
+	template<class Obj, class... Args>
+	static inline constexpr size_t argumentCount(void (Obj::* method)(Args...) const) {
+		return sizeof...(Args);
+	}
+
+	/**
+	 * Determines whether an option is variadic (only the last argument can be).
+	 */
+	template<class Obj, class... Args>
+	static inline constexpr bool isVariadic(void (Obj::* method)(Args...) const)
+	{
+		constexpr bool flags[] = {false, IsVariadic<std::remove_const_t<std::remove_reference_t<Args>>>::value...};
+		constexpr auto count = (size_t(0) + ... + size_t(IsVariadic<std::remove_const_t<std::remove_reference_t<Args>>>::value));
+		static_assert(count == 0 || (count == 1 && flags[sizeof...(Args)]), "only the last argument of an option can be variadic");
+		return count != 0;
 	}
 
 public:
@@ -170,18 +400,81 @@ public:
 	 */
 	OptionParser(const std::string &header);
 
+	/// The callbacks are destroyed with the parser (the records refer to the arena, so it is not copyable).
+	~OptionParser();
+	OptionParser(const OptionParser&) = delete;
+	OptionParser& operator=(const OptionParser&) = delete;
+
+	/// Maximum nesting depth of response files.
+	static constexpr size_t maxResponseFileDepth = 8;
+
 	/**
 	 * Process the command line arguments (expected in the form of a
-	 * list of strings) and invoke registered option callbacks when
-	 * matches are found.
+	 * vector of string views) and invoke registered option callbacks
+	 * when matches are found.
+	 *
+	 * Arguments of the form @file are replaced with the contents of the
+	 * file (one argument per line, or NUL delimited if the file contains
+	 * NUL characters), which may refer to further response files. If there
+	 * is no such file the argument is used as is, if it exists but can not
+	 * be read (like a directory) that is an error.
 	 *
 	 * If there is an error during parsing it print error message to
-	 * standard error and returns false.
+	 * the error stream (standard error by default) and returns false.
 	 *
 	 * If all arguments are parsed successfully **and** the usage page
-	 * is not requested with -h or --help then it returns true.
+	 * is not requested with -h or --help then it returns the non-option
+	 * arguments, as views of the same storage as the input (or of the
+	 * response files, which are kept until the parser is destroyed).
+	 */
+	std::optional<Arguments> processArgs(const Arguments& args);
+
+	/// Receiver of non-option arguments for the streaming interface.
+	using Sink = std::function<void(std::string_view)>;
+
+	/**
+	 * Process the command line arguments the same way as the other overload,
+	 * but pass the non-option arguments to the sink as they are encountered,
+	 * instead of collecting them.
+	 *
+	 * The sink is invoked before the subsequent arguments are processed, so
+	 * options only take effect for the arguments after them, and an error
+	 * (or the usage page) may come after some arguments have been passed to
+	 * the sink. Returns false in that case.
+	 */
+	bool processArgs(const Arguments& args, const Sink& sink);
+
+	/**
+	 * Read NUL delimited items (like the output of find -print0) from a file
+	 * descriptor until the end of input and pass them to the sink one by one.
+	 *
+	 * The items are views of an internal buffer that are only valid during the
+	 * invocation of the sink, the memory used is independent of the size of the
+	 * input. Returns false (after printing an error message) if reading fails.
+	 */
+	static bool readItems(int fd, const Sink& sink, std::ostream& err = std::cerr);
+
+	/**
+	 * Get the usage information page.
+	 *
+	 * It is rendered once and kept until options are added, the
+	 * descriptions are wrapped to fit the terminal if the standard
+	 * error is one.
 	 */
-	std::optional<std::list<std::string>> processArgs(const std::list<std::string>& args);
+	const std::string& helpPage();
+
+	/**
+	 * Find the option registered with the specified key.
+	 *
+	 * Returns null if there is no such option.
+	 */
+	Option* findOption(std::string_view key);
+
+	/**
+	 * Find the end of the values of a variadic option, which is the next
+	 * recognized option key or a "--" argument (or the end of the input).
+	 */
+	ArgIter variadicEnd(ArgIter it, ArgIter end);
 
 	/**
 	 * Add a user callback that is called when an option (specified
@@ -190,18 +483,43 @@ public:
 	template<class C>
 	inline void addOptions(const std::list<std::string>& names, const std::string& description, C&& c)
 	{
-		auto opt = std::make_shared<Option>(
-				description,
-				optionTypes(&C::operator()),
-				std::function([c{std::forward<C>(c)}](cListIter& it, cListIter end) { parseOptions(&C::operator(), c, it, end); }),
-				std::function([](cListIter& it, cListIter end) { return generateArgumentCandidates(&C::operator(), it, end); })
-		);
-
-		for(auto n: names)
+		Trace::Span span("registration", names.empty() ? std::string_view{} : std::string_view(names.front()));
+
+		using Callback = std::decay_t<C>;
+
+		void (*destroy)(void*) = nullptr;
+
+		if constexpr(!std::is_trivially_destructible_v<Callback>)
 		{
-			auto result = options.insert(std::make_pair(n, opt));
-			assert(result.second);
+			destroy = [](void* callback) { static_cast<Callback*>(callback)->~Callback(); };
 		}
+
+		const auto opt = new(arena.allocate(sizeof(Option), alignof(Option))) Option{
+				arena.copy(description),
+				optionTypes(&Callback::operator()),
+				dynamicCandidates(&Callback::operator()),
+				argumentCount(&Callback::operator()),
+				isVariadic(&Callback::operator()),
+				new(arena.allocate(sizeof(Callback), alignof(Callback))) Callback(std::forward<C>(c)),
+				[](const void* callback, ArgIter& it, ArgIter end) { return parseOptions(&Callback::operator(), *static_cast<const Callback*>(callback), it, end); },
+				destroy,
+				[](ArgIter& it, ArgIter end, std::optional<std::string_view> word) { return generateArgumentCandidates(&Callback::operator(), it, end, word); }
+		};
+
+		records.push_back(opt);
+
+		// If a key is registered again (like -h by an applet) the first option keeps it.
+		for(const auto& n: names)
+		{
+			if(std::none_of(options.begin(), options.end(), [&n](const auto& o) { return o.first == n; }))
+			{
+				options.emplace_back(arena.copy(n), opt);
+			}
+		}
+
+		indexStale = true;
+		suggestions.reset();
+		help.reset();
 	}
 
 	/**
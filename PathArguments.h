@@ -23,6 +23,40 @@
 #include "ArgumentReader.h"
 
 #include <filesystem>
+#include <chrono>
+#include <optional>
+#include <iterator>
+
+/**
+ * In-process completion of path arguments.
+ *
+ * The directory part of the word being completed is scanned directly with
+ * getdents64, the entries not matching the rest of the word are dropped
+ * before anything else is done with them, so only the matching ones are
+ * ever stat-ed or copied. The scan gives up when the number of candidates
+ * or the time spent exceeds the limits, in which case the partial result
+ * is returned (as the shell could not display more anyway).
+ */
+struct PathCompletion
+{
+	/// Maximum number of candidates generated.
+	static constexpr size_t maxCandidates = 1000;
+
+	/// Maximum time spent scanning a directory.
+	static constexpr std::chrono::milliseconds timeLimit{200};
+
+	/**
+	 * Generate the paths starting with the word. Directories are always
+	 * included (so that they can be descended into), files only if files
+	 * are requested and the name matches one of the glob patterns (or if
+	 * there are none).
+	 *
+	 * Returns nothing if the word needs to be expanded by the shell first
+	 * (e.g. it starts with a tilde or contains a variable), or if the
+	 * directory can not be read, to let the shell complete it instead.
+	 */
+	static std::optional<std::list<std::string>> complete(std::string_view word, bool files, const char* const* patterns = nullptr, const char* const* patternsEnd = nullptr);
+};
 
 struct FilePath: std::filesystem::path {
 	using path::path;
@@ -33,19 +67,77 @@ template<> struct ArgumentParser<FilePath>
 	static constexpr const auto typeName = "file";
 
 	template<class It>
-	static inline std::string parse(It& it, const It &end)
+	static inline Parsed<FilePath> parse(It& it, const It &end)
 	{
 		if(it != end)
 		{
-			return *it++;
+			return FilePath(*it++);
 		}
 
-		throw std::runtime_error("missing file name argument argument");
+		return ParseError{"missing file name argument argument"};
 	}
 
 	static inline std::pair<int, std::list<std::string>> suggest() {
 		return {1, {std::list<std::string>{}}};
 	}
+
+	static inline std::pair<int, std::list<std::string>> complete(std::string_view word)
+	{
+		if(auto ret = PathCompletion::complete(word, true))
+		{
+			return {3, std::move(*ret)};
+		}
+
+		return suggest();
+	}
+};
+
+/**
+ * A file path argument that is completed only to the names matching
+ * one of the glob patterns listed by the filter, for example:
+ *
+ *	struct Sources { static constexpr const char* patterns[] = {"*.c", "*.h"}; };
+ *
+ *	addOption("--input", "...", [](const MatchingFilePath<Sources>& p){ ... });
+ */
+template<class Filter>
+struct MatchingFilePath: FilePath {
+	using FilePath::FilePath;
+};
+
+template<class Filter> struct ArgumentParser<MatchingFilePath<Filter>>
+{
+	static constexpr const auto typeName = "file";
+
+	// The filtering can not be expressed in the static completion manifest.
+	static constexpr bool dynamicCandidates = true;
+
+	template<class It>
+	static inline Parsed<MatchingFilePath<Filter>> parse(It& it, const It &end)
+	{
+		auto ret = ArgumentParser<FilePath>::parse(it, end);
+
+		if(!ret)
+		{
+			return ret.error();
+		}
+
+		return MatchingFilePath<Filter>(std::move(*ret));
+	}
+
+	static inline std::pair<int, std::list<std::string>> suggest() {
+		return ArgumentParser<FilePath>::suggest();
+	}
+
+	static inline std::pair<int, std::list<std::string>> complete(std::string_view word)
+	{
+		if(auto ret = PathCompletion::complete(word, true, std::begin(Filter::patterns), std::end(Filter::patterns)))
+		{
+			return {3, std::move(*ret)};
+		}
+
+		return suggest();
+	}
 };
 
 struct DirectoryPath: std::filesystem::path {
@@ -57,21 +149,29 @@ template<> struct ArgumentParser<DirectoryPath>
 	static constexpr const auto typeName = "directory";
 
 	template<class It>
-	static inline std::string parse(It& it, const It &end)
+	static inline Parsed<DirectoryPath> parse(It& it, const It &end)
 	{
 		if(it != end)
 		{
-			return *it++;
+			return DirectoryPath(*it++);
 		}
 
-		throw std::runtime_error("missing directory name argument argument");
+		return ParseError{"missing directory name argument argument"};
 	}
 
 	static inline std::pair<int, std::list<std::string>> suggest() {
 		return {2, {std::list<std::string>{}}};
 	}
-};
 
+	static inline std::pair<int, std::list<std::string>> complete(std::string_view word)
+	{
+		if(auto ret = PathCompletion::complete(word, false))
+		{
+			return {3, std::move(*ret)};
+		}
 
+		return suggest();
+	}
+};
 
 #endif /* CLI_BASE_PATHARGUMENTS_H_ */
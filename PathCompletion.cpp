@@ -0,0 +1,132 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#include "PathArguments.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+#include <cstring>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/// Directory entry layout of the getdents64 system call.
+struct LinuxDirent64
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/// Whether the word has to be expanded by the shell before it can be used as a path.
+static inline bool needsExpansion(std::string_view word) {
+	return (!word.empty() && word[0] == '~') || word.find_first_of("$`\\") != std::string_view::npos;
+}
+
+std::optional<std::list<std::string>> PathCompletion::complete(std::string_view word, bool files, const char* const* patterns, const char* const* patternsEnd)
+{
+	if(needsExpansion(word))
+	{
+		return std::nullopt;
+	}
+
+	Trace::Span span("pathCompletion", word);
+
+	const auto slash = word.rfind('/');
+	const auto dirPart = (slash == std::string_view::npos) ? std::string_view{} : word.substr(0, slash + 1);
+	const auto prefix = word.substr(dirPart.length());
+
+	const int fd = open(dirPart.empty() ? "." : std::string(dirPart).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if(fd < 0)
+	{
+		return std::nullopt;
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + timeLimit;
+	const bool showHidden = !prefix.empty() && prefix[0] == '.';
+
+	std::list<std::string> ret;
+	size_t count = 0;
+	alignas(LinuxDirent64) char buffer[32 * 1024];
+
+	while(count < maxCandidates && std::chrono::steady_clock::now() < deadline)
+	{
+		const auto n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+
+		if(n <= 0)
+		{
+			break;
+		}
+
+		for(long off = 0; off < n && count < maxCandidates;)
+		{
+			const auto e = reinterpret_cast<const LinuxDirent64*>(buffer + off);
+			off += e->d_reclen;
+
+			const auto nameLength = std::strlen(e->d_name);
+
+			if(nameLength < prefix.length() || std::memcmp(e->d_name, prefix.data(), prefix.length()) != 0)
+			{
+				continue;
+			}
+
+			if(e->d_name[0] == '.' && (!showHidden || nameLength == 1 || (nameLength == 2 && e->d_name[1] == '.')))
+			{
+				continue;
+			}
+
+			// Symbolic links are followed, so that links to directories can be descended into.
+			bool isDirectory = e->d_type == DT_DIR;
+
+			if(e->d_type == DT_UNKNOWN || e->d_type == DT_LNK)
+			{
+				struct stat st;
+				isDirectory = fstatat(fd, e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+			}
+
+			if(!isDirectory)
+			{
+				if(!files)
+				{
+					continue;
+				}
+
+				if(patterns != patternsEnd && std::none_of(patterns, patternsEnd, [e](const char* p) { return fnmatch(p, e->d_name, 0) == 0; }))
+				{
+					continue;
+				}
+			}
+
+			ret.emplace_back(dirPart).append(e->d_name, nameLength);
+			count++;
+		}
+	}
+
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,223 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+
+#ifndef CLI_BASE_PERFECTHASH_H_
+#define CLI_BASE_PERFECTHASH_H_
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+#include <string_view>
+
+/**
+ * Seeded 32-bit string hash used by the perfect hash table.
+ *
+ * FNV-1a over the bytes with the seed mixed into the initial state,
+ * followed by the murmur3 finalizer to spread the bits of short keys.
+ * It is constexpr so that hashes of literal keys can be computed at
+ * compile time.
+ */
+constexpr inline uint32_t perfectHash(std::string_view str, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+	for(const char c: str)
+	{
+		h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * Perfect hash table over a fixed set of string keys.
+ *
+ * Built using the hash-and-displace method: the keys are distributed
+ * into buckets by a first hash, then for each bucket (largest first) a
+ * seed is searched for, that places all of its keys into free slots of
+ * the table using a second, seeded hash. A lookup thus costs two hash
+ * evaluations and a single key comparison, regardless of the number
+ * of keys.
+ *
+ * The table does not own the key strings, they must outlive it.
+ */
+template<class V>
+class PerfectHashTable
+{
+	/// Number of seeds tried for a bucket before growing the table.
+	static constexpr uint32_t maxSeedAttempts = 1u << 16;
+
+	/// Number of times the table is doubled before giving up.
+	static constexpr size_t maxGrowthSteps = 6;
+
+	/// Per-bucket seeds of the second level hash.
+	std::vector<uint32_t> seeds;
+
+	/// The slots, unused ones have a null key.
+	std::vector<std::pair<std::string_view, V>> slots;
+
+	static inline size_t roundUpToPowerOfTwo(size_t n)
+	{
+		size_t ret = 1;
+
+		while(ret < n)
+		{
+			ret <<= 1;
+		}
+
+		return ret;
+	}
+
+	inline bool tryBuild(const std::vector<std::pair<std::string_view, V>> &entries, size_t nSlots)
+	{
+		const auto nBuckets = roundUpToPowerOfTwo(entries.size() / 2 + 1);
+		std::vector<std::vector<size_t>> buckets(nBuckets);
+
+		for(auto i = 0u; i < entries.size(); i++)
+		{
+			buckets[perfectHash(entries[i].first, 0) & (nBuckets - 1)].push_back(i);
+		}
+
+		std::vector<size_t> order(nBuckets);
+
+		for(auto i = 0u; i < nBuckets; i++)
+		{
+			order[i] = i;
+		}
+
+		std::stable_sort(order.begin(), order.end(), [&buckets](auto a, auto b) { return buckets[a].size() > buckets[b].size(); });
+
+		seeds.assign(nBuckets, 0);
+		slots.assign(nSlots, {});
+		std::vector<size_t> placed;
+
+		for(const auto b: order)
+		{
+			const auto &bucket = buckets[b];
+
+			if(bucket.empty())
+			{
+				break;
+			}
+
+			uint32_t seed = 1;
+
+			for(; seed < maxSeedAttempts; seed++)
+			{
+				placed.clear();
+
+				for(const auto i: bucket)
+				{
+					const auto s = perfectHash(entries[i].first, seed) & (nSlots - 1);
+
+					if(slots[s].first.data() || std::find(placed.begin(), placed.end(), s) != placed.end())
+					{
+						break;
+					}
+
+					placed.push_back(s);
+				}
+
+				if(placed.size() == bucket.size())
+				{
+					break;
+				}
+			}
+
+			if(seed == maxSeedAttempts)
+			{
+				return false;
+			}
+
+			seeds[b] = seed;
+
+			for(auto j = 0u; j < bucket.size(); j++)
+			{
+				slots[placed[j]] = entries[bucket[j]];
+			}
+		}
+
+		return true;
+	}
+
+public:
+	/**
+	 * Build the table from a set of distinct (key, value) pairs.
+	 *
+	 * Any previous content is discarded. Returns false if no placement
+	 * is found within the size limit (which is certain if there are
+	 * duplicate keys), the table is empty then.
+	 */
+	inline bool build(const std::vector<std::pair<std::string_view, V>> &entries)
+	{
+		seeds.clear();
+		slots.clear();
+
+		if(entries.empty())
+		{
+			return true;
+		}
+
+		auto nSlots = roundUpToPowerOfTwo(2 * entries.size());
+
+		for(auto i = 0u; i <= maxGrowthSteps; i++, nSlots <<= 1)
+		{
+			if(tryBuild(entries, nSlots))
+			{
+				return true;
+			}
+		}
+
+		seeds.clear();
+		slots.clear();
+		return false;
+	}
+
+	/**
+	 * Look up the value associated with a key.
+	 *
+	 * Returns null if the key is not present.
+	 */
+	inline const V* find(std::string_view key) const
+	{
+		if(slots.empty())
+		{
+			return nullptr;
+		}
+
+		const auto seed = seeds[perfectHash(key, 0) & (seeds.size() - 1)];
+		const auto &slot = slots[perfectHash(key, seed) & (slots.size() - 1)];
+
+		if(slot.first.data() && slot.first == key)
+		{
+			return &slot.second;
+		}
+
+		return nullptr;
+	}
+};
+
+#endif /* CLI_BASE_PERFECTHASH_H_ */
@@ -0,0 +1,134 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+
+#include "SuggestionIndex.h"
+#include "Levenshtein.h"
+
+#include <algorithm>
+
+size_t SuggestionIndex::defaultMaxDistance(std::string_view word)
+{
+	return std::max<size_t>(1, word.length() / 3);
+}
+
+void SuggestionIndex::add(std::string_view word)
+{
+	if(nodes.empty())
+	{
+		nodes.push_back(Node{word, 0, {}});
+		return;
+	}
+
+	for(size_t idx = 0;;)
+	{
+		const auto d = levenshteinDistance(word, nodes[idx].word);
+
+		if(d == 0)
+		{
+			return;
+		}
+
+		auto &children = nodes[idx].children;
+		const auto it = std::find_if(children.begin(), children.end(), [d](const auto& c){ return c.first == d; });
+
+		if(it == children.end())
+		{
+			children.push_back({d, nodes.size()});
+			nodes[idx].maxEdge = std::max(nodes[idx].maxEdge, d);
+			nodes.push_back(Node{word, 0, {}});
+			return;
+		}
+
+		idx = it->second;
+	}
+}
+
+std::vector<std::string_view> SuggestionIndex::query(std::string_view word, size_t count, size_t maxDistance) const
+{
+	std::vector<std::pair<size_t, std::string_view>> found;
+
+	if(nodes.empty() || !count)
+	{
+		return {};
+	}
+
+	const auto better = [](const auto& a, const auto& b) {
+		return a.first < b.first || (a.first == b.first && a.second < b.second);
+	};
+
+	std::vector<size_t> pending{0};
+
+	while(!pending.empty())
+	{
+		const auto &node = nodes[pending.back()];
+		pending.pop_back();
+
+		// The radius shrinks to the worst result once there are enough of them.
+		const auto radius = (found.size() < count) ? maxDistance : std::min(maxDistance, found.back().first);
+
+		// Beyond radius + maxEdge neither the node nor any of its children can match.
+		const auto d = levenshteinDistance(word, node.word, radius + node.maxEdge);
+
+		if(d <= radius)
+		{
+			const std::pair<size_t, std::string_view> candidate{d, node.word};
+
+			if(found.size() < count || better(candidate, found.back()))
+			{
+				found.insert(std::upper_bound(found.begin(), found.end(), candidate, better), candidate);
+
+				if(found.size() > count)
+				{
+					found.pop_back();
+				}
+			}
+		}
+
+		for(const auto& c: node.children)
+		{
+			if(c.first + radius >= d && c.first <= d + radius)
+			{
+				pending.push_back(c.second);
+			}
+		}
+	}
+
+	std::vector<std::string_view> ret;
+	ret.reserve(found.size());
+	std::transform(found.begin(), found.end(), std::back_inserter(ret), [](const auto& p) { return p.second; });
+	return ret;
+}
+
+void printSuggestions(std::ostream& os, const std::vector<std::string_view>& suggestions)
+{
+	if(suggestions.size() == 1)
+	{
+		os << std::endl << "Did you mean: " << suggestions.front() << "?" << std::endl;
+	}
+	else if(!suggestions.empty())
+	{
+		os << std::endl << "Did you mean one of these?" << std::endl;
+
+		for(const auto& s: suggestions)
+		{
+			os << "    " << s << std::endl;
+		}
+	}
+}
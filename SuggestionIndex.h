@@ -0,0 +1,99 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+
+#ifndef CLI_BASE_SUGGESTIONINDEX_H_
+#define CLI_BASE_SUGGESTIONINDEX_H_
+
+#include <vector>
+#include <ostream>
+#include <utility>
+#include <string_view>
+
+/**
+ * Index of a vocabulary of words for looking up the ones closest to a
+ * mistyped word, by edit distance.
+ *
+ * Implemented as a BK-tree: every node stores the distance of each of its
+ * children to itself, so by the triangle inequality a query only needs to
+ * descend into the children whose distance is within the search radius of
+ * the distance of the query to the node. This lets a query skip most of
+ * the vocabulary, instead of computing the distance to every word.
+ *
+ * The index does not own the words, they must outlive it.
+ */
+class SuggestionIndex
+{
+	struct Node
+	{
+		/// The word stored in this node.
+		std::string_view word;
+
+		/// Largest distance of a child (used to cut off distance computation).
+		size_t maxEdge = 0;
+
+		/// Children as (distance, node index) pairs.
+		std::vector<std::pair<size_t, size_t>> children;
+	};
+
+	std::vector<Node> nodes;
+
+public:
+	/// Default number of suggestions to look up.
+	static constexpr size_t defaultCount = 3;
+
+	/// Default distance limit for a word, proportional to its length (one edit for short words).
+	static size_t defaultMaxDistance(std::string_view word);
+
+	SuggestionIndex() = default;
+
+	/// Build the index from a sequence of words.
+	template<class It>
+	inline SuggestionIndex(It first, It last)
+	{
+		for(; first != last; first++)
+		{
+			add(*first);
+		}
+	}
+
+	/// Add a word to the index (duplicates are ignored).
+	void add(std::string_view word);
+
+	/**
+	 * Find the words closest to the specified one.
+	 *
+	 * Returns at most _count_ words that are within _maxDistance_ edits,
+	 * closest first (ties in alphabetical order). The result is empty if
+	 * there is no word close enough.
+	 */
+	std::vector<std::string_view> query(std::string_view word, size_t count, size_t maxDistance) const;
+
+	/// Find the words closest to the specified one using the default limits.
+	inline std::vector<std::string_view> query(std::string_view word) const {
+		return query(word, defaultCount, defaultMaxDistance(word));
+	}
+};
+
+/**
+ * Print the "Did you mean" message for the suggestions (nothing if there are none).
+ */
+void printSuggestions(std::ostream& os, const std::vector<std::string_view>& suggestions);
+
+#endif /* CLI_BASE_SUGGESTIONINDEX_H_ */
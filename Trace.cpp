@@ -0,0 +1,139 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#include "Trace.h"
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static constexpr const char* traceEnvVarName = "CLI_BASE_TRACE";
+
+/**
+ * Collects the completed spans and writes them to the trace file
+ * when destroyed at the exit of the process.
+ */
+struct Trace::Recorder
+{
+	struct Event
+	{
+		const char* name;
+		std::string detail;
+		long long start, duration;
+		long tid;
+	};
+
+	const std::string path;
+	std::mutex mutex;
+	std::vector<Event> events;
+
+	inline Recorder(const char* path): path(path) {}
+
+	static inline long long now()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static void writeString(FILE* f, std::string_view str)
+	{
+		fputc('"', f);
+
+		for(const char c: str)
+		{
+			if(c == '"' || c == '\\')
+			{
+				fprintf(f, "\\%c", c);
+			}
+			else if(static_cast<unsigned char>(c) < 0x20)
+			{
+				fprintf(f, "\\u%04x", c);
+			}
+			else
+			{
+				fputc(c, f);
+			}
+		}
+
+		fputc('"', f);
+	}
+
+	~Recorder()
+	{
+		if(FILE* f = fopen(path.c_str(), "w"))
+		{
+			const auto pid = getpid();
+
+			fprintf(f, "{\"traceEvents\":[");
+
+			for(auto it = events.begin(); it != events.end(); it++)
+			{
+				fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"cli-base\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%ld",
+						it == events.begin() ? "" : ",", it->name, it->start, it->duration, pid, it->tid);
+
+				if(!it->detail.empty())
+				{
+					fprintf(f, ",\"args\":{\"detail\":");
+					writeString(f, it->detail);
+					fputc('}', f);
+				}
+
+				fputc('}', f);
+			}
+
+			fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+			fclose(f);
+		}
+	}
+};
+
+Trace::Recorder* Trace::recorder()
+{
+	static const auto ret = []() -> Recorder*
+	{
+		if(const auto path = std::getenv(traceEnvVarName); path && *path)
+		{
+			static Recorder recorder(path);
+			return &recorder;
+		}
+
+		return nullptr;
+	}();
+
+	return ret;
+}
+
+void Trace::Span::begin(std::string_view detail)
+{
+	this->detail = detail;
+	start = Recorder::now();
+}
+
+void Trace::Span::end()
+{
+	const auto finish = Recorder::now();
+	const auto tid = syscall(SYS_gettid);
+
+	std::lock_guard<std::mutex> lock(rec->mutex);
+	rec->events.push_back({name, std::move(detail), start, finish - start, tid});
+}
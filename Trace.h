@@ -0,0 +1,89 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#ifndef CLI_BASE_TRACE_H_
+#define CLI_BASE_TRACE_H_
+
+#include <string>
+#include <string_view>
+
+#include "Allocations.h"
+
+/**
+ * Phase tracing of the framework internals.
+ *
+ * If the CLI_BASE_TRACE environment variable is set to a file name, the
+ * spans of the framework phases (registry setup, dispatch, argument parsing,
+ * option callbacks, suggestion lookup and the applet body) are recorded with
+ * a monotonic clock and written to that file in the Chrome trace event
+ * format at exit (viewable with chrome://tracing or Perfetto).
+ *
+ * Every span is also a phase of the allocation accounting (see Allocations).
+ *
+ * When the variable is not set a span only costs testing a pointer.
+ */
+class Trace
+{
+	struct Recorder;
+
+	/// The recorder of the process, null if tracing is disabled (set up at first use).
+	static Recorder* recorder();
+
+public:
+	/**
+	 * Scoped span of a traced phase.
+	 *
+	 * The name must be a string literal, the optional detail (like the key
+	 * of an option) is only copied if tracing is enabled.
+	 */
+	class Span
+	{
+		Recorder* const rec;
+		const char* const name;
+		std::string detail;
+		long long start;
+		const Allocations::Phase phase;
+
+	public:
+		inline Span(const char* name, std::string_view detail = {}): rec(recorder()), name(name), phase(name)
+		{
+			if(rec)
+			{
+				begin(detail);
+			}
+		}
+
+		inline ~Span()
+		{
+			if(rec)
+			{
+				end();
+			}
+		}
+
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+
+	private:
+		void begin(std::string_view detail);
+		void end();
+	};
+};
+
+#endif /* CLI_BASE_TRACE_H_ */
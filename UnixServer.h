@@ -0,0 +1,264 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#ifndef CLI_BASE_UNIXSERVER_H_
+#define CLI_BASE_UNIXSERVER_H_
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+/**
+ * Helpers shared by the resident servers (hidden applets listening on a
+ * unix domain socket in a private directory).
+ */
+struct UnixServer
+{
+	/// Identity of the executable file, used to detect if it is replaced.
+	struct BinaryStamp
+	{
+		std::string path;
+		dev_t dev = 0;
+		ino_t ino = 0;
+		struct timespec mtime = {};
+
+		inline bool load()
+		{
+			struct stat st;
+
+			if(stat(path.c_str(), &st) != 0)
+			{
+				return false;
+			}
+
+			dev = st.st_dev;
+			ino = st.st_ino;
+			mtime = st.st_mtim;
+			return true;
+		}
+
+		/// Load the identity of the executable of the current process.
+		inline bool loadSelf()
+		{
+			char exe[4096];
+
+			if(const auto n = readlink("/proc/self/exe", exe, sizeof(exe) - 1); n > 0)
+			{
+				path.assign(exe, n);
+				return load();
+			}
+
+			return false;
+		}
+
+		inline bool operator==(const BinaryStamp& o) const {
+			return dev == o.dev && ino == o.ino && mtime.tv_sec == o.mtime.tv_sec && mtime.tv_nsec == o.mtime.tv_nsec;
+		}
+	};
+
+	/**
+	 * Limit the time a blocking read or write on the connection can take,
+	 * so that a peer that stops sending (or reading) can not hold up the
+	 * server. The call then fails with EAGAIN.
+	 */
+	static inline bool setTimeout(int fd, int seconds)
+	{
+		const struct timeval tv = {seconds, 0};
+		return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0
+			&& setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+	}
+
+	/// Read until the peer closes its side, returns false on error (or timeout) or if the data exceeds the limit.
+	static inline bool readAll(int fd, std::string &request, size_t maxSize)
+	{
+		char buffer[4096];
+
+		while(request.size() < maxSize)
+		{
+			const auto n = read(fd, buffer, sizeof(buffer));
+
+			if(n == 0)
+			{
+				return true;
+			}
+
+			if(n < 0)
+			{
+				if(errno == EINTR)
+				{
+					continue;
+				}
+
+				return false;
+			}
+
+			request.append(buffer, n);
+		}
+
+		return false;
+	}
+
+	/// Write all of the data, returns false on error.
+	static inline bool writeAll(int fd, std::string_view data)
+	{
+		while(!data.empty())
+		{
+			const auto n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+
+			if(n < 0)
+			{
+				if(errno == EINTR)
+				{
+					continue;
+				}
+
+				return false;
+			}
+
+			data.remove_prefix(n);
+		}
+
+		return true;
+	}
+
+	/// Whether the peer on the other end of the connection is the same user.
+	static inline bool sameUser(int fd)
+	{
+		struct ucred cred;
+		socklen_t len = sizeof(cred);
+		return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+	}
+
+	/// Fill in the address of a socket, returns false if the path is too long.
+	static inline bool makeAddress(const std::string &path, struct sockaddr_un &addr)
+	{
+		addr = {};
+		addr.sun_family = AF_UNIX;
+
+		if(path.length() >= sizeof(addr.sun_path))
+		{
+			return false;
+		}
+
+		std::memcpy(addr.sun_path, path.c_str(), path.length() + 1);
+		return true;
+	}
+
+	/// Bind the listening socket, returns -1 if there is already a live server.
+	static inline int listenOn(const std::string &path)
+	{
+		struct sockaddr_un addr;
+
+		if(!makeAddress(path, addr))
+		{
+			return -1;
+		}
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		if(fd < 0)
+		{
+			return -1;
+		}
+
+		const auto oldMask = umask(0077);
+		auto ok = bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+
+		if(!ok && errno == EADDRINUSE)
+		{
+			const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			const auto alive = connect(probe, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+			close(probe);
+
+			if(!alive)
+			{
+				unlink(path.c_str());
+				ok = bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+			}
+		}
+
+		umask(oldMask);
+
+		if(!ok || listen(fd, 16) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+
+	/// Detach from the invoking shell, returns false in the original process.
+	static inline bool daemonize()
+	{
+		if(const auto pid = fork(); pid != 0)
+		{
+			return false;
+		}
+
+		setsid();
+
+		if(const int null = open("/dev/null", O_RDWR); null >= 0)
+		{
+			dup2(null, STDIN_FILENO);
+			dup2(null, STDOUT_FILENO);
+			dup2(null, STDERR_FILENO);
+
+			if(null > STDERR_FILENO)
+			{
+				close(null);
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Wait for a connection on the listening socket, returns false if
+	 * there is none for the idle timeout (or on error). Interruptions
+	 * by signals do not count as timeout.
+	 */
+	static inline bool waitForClient(int listenFd, int idleSeconds)
+	{
+		struct pollfd pfd = {listenFd, POLLIN, 0};
+
+		while(true)
+		{
+			const auto n = poll(&pfd, 1, idleSeconds * 1000);
+
+			if(n < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			return n > 0;
+		}
+	}
+};
+
+#endif /* CLI_BASE_UNIXSERVER_H_ */
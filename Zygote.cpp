@@ -0,0 +1,169 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#include "Zygote.h"
+#include "UnixServer.h"
+
+#include <cstdint>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+std::string Zygote::socketPath()
+{
+	const auto dir = std::getenv("XDG_RUNTIME_DIR");
+	UnixServer::BinaryStamp self;
+
+	if(!dir || !*dir || !self.loadSelf())
+	{
+		return {};
+	}
+
+	return std::string(dir) + "/cli-base-" + self.path.substr(self.path.rfind('/') + 1) + ".zygote";
+}
+
+/// Read exactly the requested number of bytes.
+static bool readExact(int fd, void* data, size_t size)
+{
+	for(auto p = static_cast<char*>(data); size;)
+	{
+		const auto n = read(fd, p, size);
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(n <= 0)
+		{
+			return false;
+		}
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+/// Start the server for the next invocation (it detaches itself).
+static void startServer(const std::string &path, const char* argv0)
+{
+	const char* const args[] = {argv0, Zygote::serverAppName, path.c_str(), nullptr};
+	pid_t pid;
+
+	if(posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, const_cast<char* const*>(args), environ) == 0)
+	{
+		waitpid(pid, nullptr, 0);
+	}
+}
+
+std::optional<int> Zygote::forward(int argc, const char* argv[])
+{
+	if(argc < 1 || (argc > 1 && std::strcmp(argv[1], serverAppName) == 0))
+	{
+		return std::nullopt;
+	}
+
+	const auto path = socketPath();
+	struct sockaddr_un addr;
+
+	if(path.empty() || !UnixServer::makeAddress(path, addr))
+	{
+		return std::nullopt;
+	}
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if(fd < 0)
+	{
+		return std::nullopt;
+	}
+
+	if(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		close(fd);
+		startServer(path, argv[0]);
+		return std::nullopt;
+	}
+
+	// The request is the working directory, the number of arguments, the arguments and the environment, all NUL terminated.
+	std::string request;
+	char cwd[4096];
+
+	if(!getcwd(cwd, sizeof(cwd)))
+	{
+		close(fd);
+		return std::nullopt;
+	}
+
+	request.append(cwd).push_back('\0');
+	request.append(std::to_string(argc)).push_back('\0');
+
+	for(int i = 0; i < argc; i++)
+	{
+		request.append(argv[i]).push_back('\0');
+	}
+
+	for(auto e = environ; *e; e++)
+	{
+		request.append(*e).push_back('\0');
+	}
+
+	// The standard streams are passed along with the first part of the request.
+	const int fds[] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+
+	struct iovec iov = {request.data(), request.size()};
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	const auto cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	auto sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+
+	while(sent < 0 && errno == EINTR)
+	{
+		sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	}
+
+	char accepted;
+
+	if(sent < 0 || !UnixServer::writeAll(fd, std::string_view(request).substr(sent))
+			|| shutdown(fd, SHUT_WR) != 0 || !readExact(fd, &accepted, sizeof(accepted)))
+	{
+		close(fd);
+		return std::nullopt;
+	}
+
+	// The applet is running from here on, so the request must not be repeated even if the exit code is lost.
+	int32_t ret = -1;
+	readExact(fd, &ret, sizeof(ret));
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,67 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#ifndef CLI_BASE_ZYGOTE_H_
+#define CLI_BASE_ZYGOTE_H_
+
+#include <string>
+#include <optional>
+
+/**
+ * Client side of the zygote mode.
+ *
+ * If the CLI_BASE_ZYGOTE environment variable is set, the command line is
+ * forwarded to a resident server (the hidden _zygote applet) that has the
+ * registry and the applets initialized already, and forks a child that runs
+ * the requested applet with the arguments, environment, working directory
+ * and standard streams of the client. The exit code of the child is relayed
+ * back to the client.
+ *
+ * The client does not depend on the rest of the framework, so it can also be
+ * used to build a minimal launcher.
+ */
+struct Zygote
+{
+	/// The environment variable that enables the zygote mode.
+	static constexpr const char* envVarName = "CLI_BASE_ZYGOTE";
+
+	/// Name of the hidden applet that runs the server.
+	static constexpr const char* serverAppName = "_zygote";
+
+	/// Maximum size of a request.
+	static constexpr size_t maxRequestSize = 16 << 20;
+
+	/**
+	 * Path of the server socket for the executable of the process, in the
+	 * private runtime directory of the user. Empty if there is no such
+	 * directory.
+	 */
+	static std::string socketPath();
+
+	/**
+	 * Run the command line in the zygote server.
+	 *
+	 * Returns the exit code of the applet, or an empty optional if the
+	 * request could not be delivered, in which case the command line is to
+	 * be executed locally (the server is started for the next invocation).
+	 */
+	static std::optional<int> forward(int argc, const char* argv[]);
+};
+
+#endif /* CLI_BASE_ZYGOTE_H_ */
@@ -0,0 +1,300 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+#include "CliApp.h"
+#include "Zygote.h"
+#include "UnixServer.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <csignal>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+/**
+ * Hidden applet that runs the zygote server.
+ *
+ * Initializes the registry, the command tree and the suggestion indexes,
+ * then listens on a unix domain socket for the requests sent by the client
+ * side (see Zygote). For every request it forks a handler, that takes over
+ * the standard streams (received as SCM_RIGHTS ancillary data), the working
+ * directory and the environment of the client, acknowledges the request
+ * with a single byte and forks again to run the applet. When it exits the
+ * handler sends the exit code (or 128 plus the number of the signal that
+ * killed it) as a 32 bit integer. If the client goes away before that the
+ * applet is terminated.
+ *
+ * Like the completion server, it exits if it receives no request for the
+ * idle timeout, or if the binary it was started from is replaced, in which
+ * case the request is dropped without acknowledgement and the client runs
+ * the command line itself.
+ */
+struct ZygoteServer: CliApp, UnixServer
+{
+	static constexpr const char* appName = Zygote::serverAppName;
+	static constexpr const char* appDesc = "Zygote server";
+
+	/// Default number of seconds without requests after which the server exits.
+	static constexpr int defaultIdleSeconds = 600;
+
+	static inline CliApp& instance()
+	{
+		static ZygoteServer instance;
+		return instance;
+	}
+
+	virtual ~ZygoteServer() = default;
+
+	virtual int autocomplete(OptionParser::ArgIter from, OptionParser::ArgIter to, std::string_view word, const OptionParser::Sink& sink) override {
+		return -1;
+	}
+
+	virtual const OptionParser* collectOptions() override {
+		return nullptr;
+	}
+
+	/**
+	 * Do everything that does not depend on the request in advance, so that
+	 * the children inherit it. The applet objects are not constructed, as
+	 * every invocation runs on a new one with its own option table.
+	 */
+	static inline void prewarm()
+	{
+		const auto suggestions = [](const auto& self, const Command& node) -> void
+		{
+			if(node.firstChild != node.lastChild)
+			{
+				suggestionIndex(node, false);
+				suggestionIndex(node, true);
+			}
+
+			for(auto it = node.firstChild; it != node.lastChild; it++)
+			{
+				self(self, *it);
+			}
+		};
+
+		suggestions(suggestions, commands());
+	}
+
+	/// Receive the first part of the request along with the standard streams of the client.
+	static inline bool receive(int fd, std::string &request, int (&fds)[3])
+	{
+		char buffer[4096];
+		alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+
+		struct iovec iov = {buffer, sizeof(buffer)};
+		struct msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		const auto n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		const auto cmsg = CMSG_FIRSTHDR(&msg);
+
+		if(n <= 0 || (msg.msg_flags & MSG_CTRUNC) || !cmsg || cmsg->cmsg_level != SOL_SOCKET
+				|| cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+		{
+			return false;
+		}
+
+		std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+		request.assign(buffer, n);
+		return true;
+	}
+
+	/// Wait for the applet to exit, terminating it if the client goes away.
+	static inline int wait(pid_t pid, int fd)
+	{
+#ifdef SYS_pidfd_open
+		if(const int pidFd = syscall(SYS_pidfd_open, pid, 0); pidFd >= 0)
+		{
+			// Hangup is reported on the connection even if no events are requested.
+			struct pollfd pfds[] = {{pidFd, POLLIN, 0}, {fd, 0, 0}};
+
+			while(poll(pfds, 2, -1) >= 0 || errno == EINTR)
+			{
+				if(pfds[0].revents)
+				{
+					break;
+				}
+
+				if(pfds[1].revents)
+				{
+					kill(pid, SIGTERM);
+					pfds[1].fd = -1;
+				}
+			}
+
+			close(pidFd);
+		}
+#endif
+
+		int status;
+		while(waitpid(pid, &status, 0) < 0)
+		{
+			if(errno != EINTR)
+			{
+				return -1;
+			}
+		}
+
+		return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	}
+
+	/// Handle a request in a child process of the server.
+	[[noreturn]] static inline void handle(int fd)
+	{
+		signal(SIGCHLD, SIG_DFL);
+
+		std::string request;
+		int fds[3];
+
+		if(!receive(fd, request, fds))
+		{
+			std::_Exit(-1);
+		}
+
+		if(!readAll(fd, request, Zygote::maxRequestSize) || request.back() != '\0')
+		{
+			std::_Exit(-1);
+		}
+
+		std::vector<char*> fields;
+
+		for(size_t start = 0; start < request.size(); start = request.find('\0', start) + 1)
+		{
+			fields.push_back(&request[start]);
+		}
+
+		const auto argc = fields.size() > 1 ? std::atoi(fields[1]) : 0;
+
+		if(argc < 1 || fields.size() < size_t(2 + argc) || chdir(fields[0]) != 0)
+		{
+			std::_Exit(-1);
+		}
+
+		for(int i = 0; i < 3; i++)
+		{
+			dup2(fds[i], i);
+			close(fds[i]);
+		}
+
+		clearenv();
+
+		for(auto it = fields.begin() + 2 + argc; it != fields.end(); it++)
+		{
+			putenv(*it);
+		}
+
+		std::vector<const char*> argv(fields.begin() + 2, fields.begin() + 2 + argc);
+		argv.push_back(nullptr);
+
+		if(!writeAll(fd, std::string_view("\0", 1)))
+		{
+			std::_Exit(-1);
+		}
+
+		const auto pid = fork();
+
+		if(pid == 0)
+		{
+			close(fd);
+			std::exit(dispatch(argc, argv.data()));
+		}
+
+		const int32_t ret = (pid < 0) ? -1 : wait(pid, fd);
+		writeAll(fd, std::string_view(reinterpret_cast<const char*>(&ret), sizeof(ret)));
+		std::_Exit(0);
+	}
+
+	virtual int operator()(int argc, const char* argv[]) override
+	{
+		if(argc < 1)
+		{
+			return -1;
+		}
+
+		const std::string path = argv[0];
+		const int idleSeconds = (argc > 1) ? std::atoi(argv[1]) : defaultIdleSeconds;
+
+		BinaryStamp started;
+
+		if(!started.loadSelf())
+		{
+			return -1;
+		}
+
+		const int listenFd = listenOn(path);
+
+		if(listenFd < 0)
+		{
+			return -1;
+		}
+
+		if(!daemonize())
+		{
+			close(listenFd);
+			return 0;
+		}
+
+		prewarm();
+
+		// The handlers are not waited for.
+		signal(SIGCHLD, SIG_IGN);
+
+		while(waitForClient(listenFd, idleSeconds))
+		{
+			const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+			if(fd < 0)
+			{
+				continue;
+			}
+
+			BinaryStamp current{started.path};
+
+			if(!current.load() || !(current == started))
+			{
+				unlink(path.c_str());
+				close(listenFd);
+				close(fd);
+				std::_Exit(0);
+			}
+
+			if(sameUser(fd) && fork() == 0)
+			{
+				close(listenFd);
+				handle(fd);
+			}
+
+			close(fd);
+		}
+
+		unlink(path.c_str());
+		close(listenFd);
+		std::_Exit(0);
+	}
+};
+
+CLI_APP_REGISTER(ZygoteServer, false);
@@ -0,0 +1,311 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2021 Tamás Seller. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *******************************************************************************/
+
+
+/*
+ * Benchmarks for the framework internals.
+ *
+ * Every result is written to the standard output as a JSON object on a
+ * separate line, with the name of the measurement, the unit and the
+ * statistics of the samples. The output of the applets themselves is
+ * discarded during the measurements. The measurements are:
+ *
+ *  - coldStart: executing the binary to run an applet with an option,
+ *  - processArgs: parsing a long argument vector, per argument,
+ *  - levenshteinDistance: the distance of typical (and non-ASCII) typos,
+ *  - suggestionIndexBuild and suggestionQuery: building the suggestion
+ *    index of the applet names and looking up a mistyped name in it,
+ *  - autocompleteApplets: completing the applet name,
+ *  - autocompleteOptionsFirst, autocompleteOptions: completing options of
+ *    an applet for the first time (with the dry run collecting them) and
+ *    afterwards, autocompleteOptionsNul is the same in the NUL delimited
+ *    format,
+ *  - dispatch and dispatchUnknown: running an applet through the main
+ *    entry point, and the error path of an unknown applet name.
+ *
+ * If the first argument is --exec the rest of the arguments is executed
+ * as a normal command line of the synthetic tool, this is used to measure
+ * the cold start of the binary.
+ *
+ * If the allocations are counted (see Allocations), the results also
+ * contain the mean number of allocations and bytes allocated per operation.
+ * Allocation budgets can be given as --budget <benchmark>=<allocations>
+ * arguments, the exit code is non-zero if any of them is exceeded.
+ */
+
+#include "CliApp.h"
+#include "Allocations.h"
+#include "Levenshtein.h"
+#include "SuggestionIndex.h"
+
+#include <chrono>
+#include <string>
+#include <map>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern const unsigned int syntheticApplets;
+extern const unsigned int syntheticOptions;
+
+using Clock = std::chrono::steady_clock;
+
+/// Where the results go, the standard output is redirected for the applets.
+static FILE* results;
+
+/// Maximum mean number of allocations per operation of the benchmarks.
+static std::map<std::string, double> budgets;
+
+/// Set if a budget is exceeded.
+static bool overBudget = false;
+
+/// The durations of the samples in nanoseconds, and the allocations made by all of them.
+struct Samples
+{
+	std::vector<double> durations;
+	Allocations::Counters allocations;
+};
+
+/// Measure a function a number of times.
+static Samples sample(size_t count, const std::function<void(size_t)> &f)
+{
+	Samples ret;
+	ret.durations.reserve(count);
+
+	const auto before = Allocations::query();
+
+	for(auto i = 0u; i < count; i++)
+	{
+		const auto start = Clock::now();
+		f(i);
+		ret.durations.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+	}
+
+	const auto after = Allocations::query();
+	ret.allocations = {after.count - before.count, after.bytes - before.bytes};
+	return ret;
+}
+
+/// Write the statistics of the samples, divided by the number of operations per sample.
+static void report(const char* name, const char* unit, Samples result, double opsPerSample = 1)
+{
+	auto &samples = result.durations;
+	std::sort(samples.begin(), samples.end());
+
+	for(auto &s: samples)
+	{
+		s /= opsPerSample;
+	}
+
+	double sum = 0;
+	for(const auto s: samples)
+	{
+		sum += s;
+	}
+
+	fprintf(results, "{\"benchmark\": \"%s\", \"unit\": \"%s\", \"samples\": %zu, \"min\": %.1f, \"median\": %.1f, \"mean\": %.1f, \"max\": %.1f, "
+			"\"applets\": %u, \"options\": %u", name, unit, samples.size(), samples.front(), samples[samples.size() / 2],
+			sum / samples.size(), samples.back(), syntheticApplets, syntheticOptions);
+
+	if(Allocations::enabled)
+	{
+		const auto ops = samples.size() * opsPerSample;
+		const auto allocations = result.allocations.count / ops;
+
+		fprintf(results, ", \"allocations\": %.1f, \"bytes\": %.1f", allocations, result.allocations.bytes / ops);
+
+		if(const auto it = budgets.find(name); it != budgets.end() && allocations > it->second)
+		{
+			fprintf(results, ", \"budget\": %.1f, \"overBudget\": true", it->second);
+			overBudget = true;
+		}
+	}
+
+	fprintf(results, "}\n");
+	fflush(results);
+}
+
+static int runMain(std::vector<const char*> args)
+{
+	args.insert(args.begin(), "bench");
+	return CliApp::main(args.size(), args.data());
+}
+
+static void benchProcessArgs()
+{
+	OptionParser parser("Benchmark");
+	std::vector<std::string> keys;
+	unsigned int sum = 0;
+
+	for(auto j = 0u; j < syntheticOptions; j++)
+	{
+		keys.push_back("--option-" + std::to_string(j));
+		parser.addOption(keys.back(), "Integer option", [&sum](int v){ sum += v; });
+	}
+
+	std::vector<std::string> storage;
+	for(auto i = 0u; i < 100000; i++)
+	{
+		storage.push_back(keys[i % keys.size()]);
+		storage.push_back(std::to_string(i));
+		storage.push_back("positional-" + std::to_string(i));
+	}
+
+	const OptionParser::Arguments args(storage.begin(), storage.end());
+
+	report("processArgs", "ns/argument", sample(20, [&](size_t) { parser.processArgs(args); }), args.size());
+}
+
+static std::vector<std::string> appletNames()
+{
+	std::vector<std::string> ret;
+	for(auto i = 0u; i < syntheticApplets; i++)
+	{
+		ret.push_back("app_" + std::to_string(i));
+	}
+
+	return ret;
+}
+
+static void benchDispatch()
+{
+	const auto names = appletNames();
+
+	report("dispatch", "ns", sample(1000, [&](size_t i) { runMain({names[i % names.size()].c_str(), "--option-1", "1"}); }));
+
+	report("dispatchUnknown", "ns", sample(20, [&](size_t) { runMain({"app_x0"}); }));
+}
+
+static void benchLevenshtein()
+{
+	static constexpr const char* pairs[][2] = {
+		{"--option-12", "--optoin-12"},
+		{"--configuration-file", "--config"},
+		{"remote-add", "remote-ad"},
+		{"ünïcödé-öptïön", "unicode-option"},
+	};
+
+	report("levenshteinDistance", "ns", sample(1000, [&](size_t i) {
+		volatile auto d = levenshteinDistance(pairs[i % 4][0], pairs[i % 4][1]);
+		(void)d;
+	}));
+}
+
+static void benchSuggestion()
+{
+	std::vector<std::string> names;
+	for(auto i = 0u; i < syntheticApplets; i++)
+	{
+		names.push_back("app_" + std::to_string(i));
+	}
+
+	std::vector<SuggestionIndex> index;
+	report("suggestionIndexBuild", "ns", sample(1, [&](size_t) { index.emplace_back(names.begin(), names.end()); }));
+
+	report("suggestionQuery", "ns", sample(1000, [&](size_t i) {
+		auto name = names[i % names.size()];
+		name[0] = 'x';
+		index.front().query(name);
+	}));
+}
+
+static void benchAutocomplete()
+{
+	const auto names = appletNames();
+
+	report("autocompleteApplets", "ns", sample(20, [&](size_t) { runMain({"_autocomplete", "1", "bench"}); }));
+
+	// The first request for an applet includes the dry run that collects the options.
+	report("autocompleteOptionsFirst", "ns", sample(names.size(), [&](size_t i) {
+		runMain({"_autocomplete", "2", "bench", names[i].c_str()});
+	}));
+
+	report("autocompleteOptions", "ns", sample(names.size(), [&](size_t i) {
+		runMain({"_autocomplete", "2", "bench", names[i].c_str()});
+	}));
+
+	report("autocompleteOptionsNul", "ns", sample(names.size(), [&](size_t i) {
+		runMain({"_autocomplete", "-0", "2", "bench", names[i].c_str()});
+	}));
+}
+
+static void benchColdStart(const char* self)
+{
+	// Only the allocations of the parent are counted, not those of the started binary.
+	report("coldStart", "ns", sample(50, [&](size_t) {
+		if(const auto pid = fork(); pid == 0)
+		{
+			execl(self, self, "--exec", "app_0", "--option-1", "1", nullptr);
+			_exit(127);
+		}
+		else
+		{
+			int status;
+			waitpid(pid, &status, 0);
+		}
+	}));
+}
+
+int main(int argc, const char* argv[])
+{
+	if(argc > 1 && std::strcmp(argv[1], "--exec") == 0)
+	{
+		return CliApp::main(argc - 1, argv + 1);
+	}
+
+	for(auto i = 1; i + 1 < argc; i += 2)
+	{
+		if(std::strcmp(argv[i], "--budget") == 0)
+		{
+			if(const auto eq = std::strchr(argv[i + 1], '='))
+			{
+				budgets[std::string(argv[i + 1], eq)] = std::atof(eq + 1);
+			}
+		}
+	}
+
+	results = fdopen(dup(STDOUT_FILENO), "w");
+
+	if(const int null = open("/dev/null", O_WRONLY); null >= 0)
+	{
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(null);
+	}
+
+	char self[4096];
+	const auto n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	self[n > 0 ? n : 0] = '\0';
+
+	benchColdStart(self);
+	benchProcessArgs();
+	benchLevenshtein();
+	benchSuggestion();
+	benchAutocomplete();
+	benchDispatch();
+
+	return overBudget ? 1 : 0;
+}
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Generates a synthetic registry of applets for the benchmarks.
+#
+# Usage: generate.sh <number of applets> <number of options per applet>
+#
+
+applets=${1:-200}
+options=${2:-20}
+
+cat <<HEADER
+// Generated by generate.sh $applets $options, do not edit.
+
+#include "CliApp.h"
+
+#include <string>
+
+extern const unsigned int syntheticApplets = $applets;
+extern const unsigned int syntheticOptions = $options;
+HEADER
+
+i=0
+while [ $i -lt $applets ]; do
+	echo
+	echo "CLI_APP(app_$i, \"Synthetic applet $i\")"
+	echo "{"
+	echo "	unsigned int sum = 0;"
+
+	j=0
+	while [ $j -lt $options ]; do
+		case $((j % 3)) in
+			0) echo "	addOptions({\"-o$j\", \"--option-$j\"}, \"Synthetic flag $j\", [&](){ sum++; });";;
+			1) echo "	addOptions({\"-o$j\", \"--option-$j\"}, \"Synthetic integer option $j\", [&](int v){ sum += v; });";;
+			2) echo "	addOptions({\"-o$j\", \"--option-$j\"}, \"Synthetic text option $j\", [&](const std::string& v){ sum += v.length(); });";;
+		esac
+		j=$((j + 1))
+	done
+
+	echo
+	echo "	if(auto args = processCommandLine())"
+	echo "	{"
+	echo "		return sum ? 0 : 1;"
+	echo "	}"
+	echo
+	echo "	return -1;"
+	echo "}"
+	i=$((i + 1))
+done
@@ -4,9 +4,21 @@ INCLUDE_DIRS := $(INCLUDE_DIRS) $(curdir)/.
 
 SOURCES := $(SOURCES) $(curdir)/CliApp.cpp
 SOURCES := $(SOURCES) $(curdir)/Levenshtein.cpp
+SOURCES := $(SOURCES) $(curdir)/SuggestionIndex.cpp
 SOURCES := $(SOURCES) $(curdir)/OptionParser.cpp
 SOURCES := $(SOURCES) $(curdir)/Autocomplete.cpp
+SOURCES := $(SOURCES) $(curdir)/CompletionServer.cpp
+SOURCES := $(SOURCES) $(curdir)/Manifest.cpp
+SOURCES := $(SOURCES) $(curdir)/Trace.cpp
+SOURCES := $(SOURCES) $(curdir)/Allocations.cpp
+SOURCES := $(SOURCES) $(curdir)/Zygote.cpp
+SOURCES := $(SOURCES) $(curdir)/ZygoteServer.cpp
+SOURCES := $(SOURCES) $(curdir)/Batch.cpp
+SOURCES := $(SOURCES) $(curdir)/PathCompletion.cpp
+SOURCES := $(SOURCES) $(curdir)/CandidateCache.cpp
+SOURCES := $(SOURCES) $(curdir)/CandidateRanker.cpp
 
 LIBS := $(LIBS) stdc++fs
+LIBS := $(LIBS) pthread
 
 undefine curdir
\ No newline at end of file